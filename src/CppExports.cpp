@@ -15,11 +15,13 @@
 //  along with this program.  If not, see <https://www.gnu.org/licenses/>.
 
 #include "RPIServiceImpl.h"
+#include "DataFrame.h"
 #include "HTMLViewer.h"
 #include "Init.h"
 #include "RStuff/Export.h"
 #include "RStuff/RInclude.h"
 #include <csignal>
+#include "RStuff/RObjects.h"
 #include "RStuff/RUtil.h"
 #include "RStudioApi.h"
 
@@ -109,6 +111,20 @@ CppExport SEXP _jetbrains_View(SEXP expr, SEXP env, SEXP title) {
   CPP_END
 }
 
+CppExport SEXP _jetbrains_dataFrameColumnSummaries(SEXP refIndex) {
+  CPP_BEGIN
+    return getDataFrameColumnSummaries(asIntOrError(refIndex));
+  CPP_END
+}
+
+CppExport SEXP _jetbrains_asyncEventStats() {
+  CPP_BEGIN
+    long long events = rpiService->asyncEventsSent;
+    long long messages = rpiService->asyncMessagesSent;
+    return RI->list(named("events", (double)events), named("messages", (double)messages));
+  CPP_END
+}
+
 CppExport SEXP _jetbrains_debugger_enable() {
   CPP_BEGIN
     rDebugger.enable();
@@ -355,6 +371,8 @@ static const R_CallMethodDef CallEntries[] = {
     {".jetbrains_ther_device_rescale_stored", (DL_FUNC) &_rplugingraphics_jetbrains_ther_device_rescale_stored, 6},
     {".jetbrains_ther_device_shutdown", (DL_FUNC) &_rplugingraphics_jetbrains_ther_device_shutdown, 0},
     {".jetbrains_View", (DL_FUNC) &_jetbrains_View, 3},
+    {".jetbrains_dataFrameColumnSummaries", (DL_FUNC) &_jetbrains_dataFrameColumnSummaries, 1},
+    {".jetbrains_asyncEventStats", (DL_FUNC) &_jetbrains_asyncEventStats, 0},
     {".jetbrains_debugger_enable", (DL_FUNC) &_jetbrains_debugger_enable, 0},
     {".jetbrains_debugger_disable", (DL_FUNC) &_jetbrains_debugger_disable, 0},
     {".jetbrains_exception_handler", (DL_FUNC) &_jetbrains_exception_handler, 1},
@@ -20,6 +20,12 @@
 #include "IO.h"
 #include "RStuff/RUtil.h"
 #include "DataFrame.h"
+#include "Options.h"
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
 
 const char* ROW_NAMES_COL = "rwr_rownames_column";
 
@@ -53,7 +59,193 @@ static std::vector<SEXP> getEqualityVector(SEXP _x) {
   return v;
 }
 
+static const R_xlen_t COLUMN_FINGERPRINT_SAMPLES = 4096;
+
+static size_t hashColumnContent(SEXP x) {
+  size_t hash = 0;
+  auto combine = [&](size_t value) { hash ^= value + 0x9e3779b9 + (hash << 6) + (hash >> 2); };
+  auto combineElement = [&](R_xlen_t i) {
+    switch (TYPEOF(x)) {
+      case LGLSXP: combine(std::hash<int>()(LOGICAL_ELT(x, i))); break;
+      case INTSXP: combine(std::hash<int>()(INTEGER_ELT(x, i))); break;
+      case REALSXP: {
+        double value = REAL_ELT(x, i);
+        uint64_t bits;
+        memcpy(&bits, &value, sizeof(bits));
+        combine(std::hash<uint64_t>()(bits));
+        break;
+      }
+      case STRSXP: combine(std::hash<SEXP>()(STRING_ELT(x, i))); break;
+      case VECSXP: combine(std::hash<SEXP>()(VECTOR_ELT(x, i))); break;
+      default: break;
+    }
+  };
+  // Long columns are sampled evenly, the last element is always included since appending changes it
+  R_xlen_t length = Rf_xlength(x);
+  R_xlen_t step = std::max<R_xlen_t>(1, length / COLUMN_FINGERPRINT_SAMPLES);
+  for (R_xlen_t i = 0; i < length; i += step) combineElement(i);
+  if (length > 0) combineElement(length - 1);
+  return hash;
+}
+
+static std::vector<DataFrameColumnFingerprint> getColumnFingerprints(SEXP x) {
+  std::vector<DataFrameColumnFingerprint> result;
+  if (TYPEOF(x) != VECSXP || Rf_isMatrix(x)) return result;
+  for (R_xlen_t i = 0; i < Rf_xlength(x); ++i) {
+    SEXP column = VECTOR_ELT(x, i);
+    result.push_back({column, Rf_xlength(column), hashColumnContent(column)});
+  }
+  return result;
+}
+
+// The value of the attribute as it is stored, i.e. without expanding compact row names
+static SEXP getStoredRowNames(SEXP x) {
+  for (SEXP a = ATTRIB(x); a != R_NilValue; a = CDR(a)) {
+    if (TAG(a) == R_RowNamesSymbol) return CAR(a);
+  }
+  return R_NilValue;
+}
+
+static bool isCompactRowNames(SEXP rowNames) {
+  return TYPEOF(rowNames) == INTSXP && Rf_xlength(rowNames) == 2 && INTEGER_ELT(rowNames, 0) == NA_INTEGER;
+}
+
+// The columns are shared with the user's table (see `convertPlainDataFrame`), so they are never read through
+// INTEGER()/REAL()/... which would materialise ALTREP columns (compact sequences, arrow or vroom columns) in place.
+// Plain vectors are read from their buffer, ALTREP ones element by element or by regions
+template <typename T> T getVectorElt(SEXP x, R_xlen_t i);
+template <> int getVectorElt<int>(SEXP x, R_xlen_t i) {
+  return TYPEOF(x) == LGLSXP ? LOGICAL_ELT(x, i) : INTEGER_ELT(x, i);
+}
+template <> double getVectorElt<double>(SEXP x, R_xlen_t i) { return REAL_ELT(x, i); }
+template <> Rcomplex getVectorElt<Rcomplex>(SEXP x, R_xlen_t i) { return COMPLEX_ELT(x, i); }
+
+template <typename T> R_xlen_t getVectorRegion(SEXP x, R_xlen_t start, R_xlen_t size, T* buf);
+template <> R_xlen_t getVectorRegion<int>(SEXP x, R_xlen_t start, R_xlen_t size, int* buf) {
+  return TYPEOF(x) == LGLSXP ? LOGICAL_GET_REGION(x, start, size, buf) : INTEGER_GET_REGION(x, start, size, buf);
+}
+template <> R_xlen_t getVectorRegion<double>(SEXP x, R_xlen_t start, R_xlen_t size, double* buf) {
+  return REAL_GET_REGION(x, start, size, buf);
+}
+template <> R_xlen_t getVectorRegion<Rcomplex>(SEXP x, R_xlen_t start, R_xlen_t size, Rcomplex* buf) {
+  return COMPLEX_GET_REGION(x, start, size, buf);
+}
+
+template <typename T>
+class VectorReader {
+public:
+  explicit VectorReader(SEXP x) : x(x), data((const T*)DATAPTR_OR_NULL(x)) {}
+
+  T operator [] (R_xlen_t i) const { return data != nullptr ? data[i] : getVectorElt<T>(x, i); }
+
+  // Buffer of the whole vector, an ALTREP vector without one is copied into `copy`
+  const T* getAll(std::vector<T> &copy) const {
+    if (data != nullptr) return data;
+    copy.resize(Rf_xlength(x));
+    getVectorRegion<T>(x, 0, (R_xlen_t)copy.size(), copy.data());
+    return copy.data();
+  }
+
+private:
+  SEXP x;
+  const T* data;
+};
+
 static std::unordered_map<int, DataFrameInfo*> dataFrameCache;
+// Registered tables by the hash of their equality vector, so that viewing the same table again finds its info at once
+static std::unordered_multimap<size_t, DataFrameInfo*> dataFrameIndex;
+// Registered tables from the least to the most recently used
+static std::list<DataFrameInfo*> dataFrameLru;
+
+static size_t hashEqualityVector(std::vector<SEXP> const& v) {
+  size_t hash = 0;
+  for (SEXP x : v) hash ^= std::hash<SEXP>()(x) + 0x9e3779b9 + (hash << 6) + (hash >> 2);
+  return hash;
+}
+
+static void unindexDataFrame(DataFrameInfo *info) {
+  auto range = dataFrameIndex.equal_range(info->equalityHash);
+  for (auto it = range.first; it != range.second; ++it) {
+    if (it->second == info) {
+      dataFrameIndex.erase(it);
+      return;
+    }
+  }
+}
+
+static void setEqualityVector(DataFrameInfo *info, SEXP x) {
+  unindexDataFrame(info);
+  info->equalityVector = getEqualityVector(x);
+  info->equalityHash = hashEqualityVector(info->equalityVector);
+  dataFrameIndex.emplace(info->equalityHash, info);
+}
+
+// Size of the data of the columns of the converted table which are not shared with the initial one.
+// The initial table is normally still bound to a variable of the user, so releasing the viewer
+// only frees what the conversion has allocated. Compact ALTREP vectors (e.g. automatic row names) take no memory
+static size_t estimateOwnedSize(SEXP dataFrame, SEXP initialDataFrame) {
+  auto getVectorSize = [](SEXP v) -> size_t {
+    if (ALTREP(v) && DATAPTR_OR_NULL(v) == nullptr) return 0;
+    switch (TYPEOF(v)) {
+      case LGLSXP: case INTSXP: return Rf_xlength(v) * sizeof(int);
+      case REALSXP: return Rf_xlength(v) * sizeof(double);
+      case CPLXSXP: return Rf_xlength(v) * sizeof(Rcomplex);
+      case STRSXP: case VECSXP: return Rf_xlength(v) * sizeof(SEXP);
+      case RAWSXP: return Rf_xlength(v);
+      default: return 0;
+    }
+  };
+  if (TYPEOF(dataFrame) != VECSXP) return dataFrame == initialDataFrame ? 0 : getVectorSize(dataFrame);
+  std::unordered_set<SEXP> shared;
+  if (TYPEOF(initialDataFrame) == VECSXP) {
+    for (R_xlen_t i = 0; i < Rf_xlength(initialDataFrame); ++i) shared.insert(VECTOR_ELT(initialDataFrame, i));
+    shared.insert(getStoredRowNames(initialDataFrame));
+  }
+  size_t size = 0;
+  for (R_xlen_t i = 0; i < Rf_xlength(dataFrame); ++i) {
+    SEXP column = VECTOR_ELT(dataFrame, i);
+    if (!shared.count(column)) size += getVectorSize(column);
+  }
+  return size;
+}
+
+static DataFrameInfo *getBaseDataFrame(DataFrameInfo *info) {
+  if (info->baseIndex == 0) return nullptr;
+  auto it = dataFrameCache.find(info->baseIndex);
+  return it == dataFrameCache.end() ? nullptr : it->second;
+}
+
+// Only the converted table is released, which is what `estimatedSize` accounts for. The initial table is kept
+// as the last snapshot in case the refresher fails, and the equality vector is kept (and indexed)
+// in order to tell whether the restored table has changed
+static void evictDataFrame(DataFrameInfo *info) {
+  info->isEvicted = true;
+  info->dataFrame = R_NilValue;
+  info->columnSummaries = R_NilValue;
+  info->columnFingerprints.clear();
+  // Views share the table, so it's only released together with them
+  for (DataFrameInfo *view : info->views) {
+    view->isEvicted = true;
+    view->dataFrame = R_NilValue;
+    view->columnSummaries = R_NilValue;
+  }
+}
+
+// Releases the least recently used tables until the rest fits into the budget.
+// Only the tables which can be restored by their refreshers and which own some memory are evicted
+static void evictDataFrames(DataFrameInfo *current) {
+  size_t budget = (size_t)commandLineOptions.dataFrameCacheBudgetMb << 20;
+  size_t total = 0;
+  for (DataFrameInfo *info : dataFrameLru) {
+    if (!info->isEvicted) total += info->estimatedSize;
+  }
+  for (auto it = dataFrameLru.begin(); it != dataFrameLru.end() && total > budget; ++it) {
+    DataFrameInfo *info = *it;
+    if (info == current || info->isEvicted || !info->refresher || info->estimatedSize == 0) continue;
+    total -= info->estimatedSize;
+    evictDataFrame(info);
+  }
+}
 
 DataFrameInfo::DataFrameInfo() {
   static int currentIndex = 0;
@@ -63,13 +255,105 @@ DataFrameInfo::DataFrameInfo() {
 DataFrameInfo::~DataFrameInfo() {
   getDataFrameStorageEnv().assign(std::to_string(uniqueIndex), R_NilValue);
   if (finalizer) finalizer();
+  if (DataFrameInfo *base = getBaseDataFrame(this)) base->views.erase(this);
+  for (DataFrameInfo *view : views) view->baseIndex = 0;
   dataFrameCache.erase(uniqueIndex);
+  unindexDataFrame(this);
+  if (isInLru) dataFrameLru.erase(lruPosition);
+}
+
+static SEXP getAutomaticRowNamesColumn(int nrow) {
+  // `1:n` is a compact sequence, it's not allocated as long as it's read through `VectorReader`
+  return nrow > 0 ? RI->colon(1, nrow) : Rf_allocVector(INTSXP, 0);
+}
+
+static bool isPlainDataFrameClass(SEXP x) {
+  SEXP cls = Rf_getAttrib(x, R_ClassSymbol);
+  if (TYPEOF(cls) != STRSXP) return false;
+  if (Rf_xlength(cls) == 1) return !strcmp(CHAR(STRING_ELT(cls, 0)), "data.frame");
+  return Rf_xlength(cls) == 3 && !strcmp(CHAR(STRING_ELT(cls, 0)), "tbl_df") &&
+         !strcmp(CHAR(STRING_ELT(cls, 1)), "tbl") && !strcmp(CHAR(STRING_ELT(cls, 2)), "data.frame");
+}
+
+// Builds the same table as the conversion through tibble in `initDataFrame` for plain data frames and tibbles,
+// but the columns are shared with the original table instead of being copied.
+// Returns R_NilValue if the table needs the full conversion
+static SEXP convertPlainDataFrame(SEXP x) {
+  if (TYPEOF(x) != VECSXP || !isPlainDataFrameClass(x)) return R_NilValue;
+  SEXP rowNames = getStoredRowNames(x);
+  int nrow;
+  if (isCompactRowNames(rowNames)) {
+    nrow = std::abs(INTEGER_ELT(rowNames, 1));
+  } else if (TYPEOF(rowNames) == INTSXP || TYPEOF(rowNames) == STRSXP) {
+    nrow = (int)Rf_xlength(rowNames);
+  } else {
+    return R_NilValue;
+  }
+  int ncol = (int)Rf_xlength(x);
+  for (int i = 0; i < ncol; ++i) {
+    SEXP column = VECTOR_ELT(x, i);
+    if (Rf_inherits(column, "POSIXlt")) continue;
+    if (!Rf_isVectorAtomic(column) && !(TYPEOF(column) == VECSXP && !OBJECT(column))) return R_NilValue;
+    if (Rf_getAttrib(column, R_DimSymbol) != R_NilValue || Rf_xlength(column) != nrow) return R_NilValue;
+  }
+
+  ShieldSEXP rowNamesColumn = isCompactRowNames(rowNames) ? getAutomaticRowNamesColumn(nrow) : [&] {
+    if (TYPEOF(rowNames) == INTSXP) return rowNames;
+    PrSEXP rowNamesAsNum = RI->strtoi(rowNames); // As integer (but not numeric)
+    if (asBool(RI->any(RI->isNa(rowNamesAsNum)))) {
+      rowNamesAsNum = RI->asNumeric(rowNames); // As numeric
+    }
+    return asBool(RI->any(RI->isNa(rowNamesAsNum))) ? rowNames : (SEXP)rowNamesAsNum;
+  }();
+
+  ShieldSEXP names = Rf_getAttrib(x, R_NamesSymbol);
+  ShieldSEXP newNames = Rf_allocVector(STRSXP, ncol + 1);
+  SET_STRING_ELT(newNames, 0, Rf_mkChar(ROW_NAMES_COL));
+  for (int i = 0; i < ncol; ++i) {
+    SEXP name = i < names.length() ? STRING_ELT(names, i) : NA_STRING;
+    if (name == NA_STRING || CHAR(name)[0] == '\0') {
+      name = Rf_mkChar(("Column " + std::to_string(i + 1)).c_str());
+    }
+    SET_STRING_ELT(newNames, i + 1, name);
+  }
+
+  ShieldSEXP result = Rf_allocVector(VECSXP, ncol + 1);
+  SET_VECTOR_ELT(result, 0, rowNamesColumn);
+  for (int i = 0; i < ncol; ++i) {
+    SEXP column = VECTOR_ELT(x, i);
+    if (Rf_inherits(column, "POSIXlt")) {
+      SET_VECTOR_ELT(result, i + 1, RI->asPOSIXct(column));
+    } else {
+      // The column is shared with the user's table, any modification of it on either side must copy it
+      MARK_NOT_MUTABLE(column);
+      SET_VECTOR_ELT(result, i + 1, column);
+    }
+  }
+  Rf_setAttrib(result, R_NamesSymbol, newNames);
+  ShieldSEXP compactRowNames = Rf_allocVector(INTSXP, 2);
+  INTEGER(compactRowNames)[0] = NA_INTEGER;
+  INTEGER(compactRowNames)[1] = -nrow;
+  Rf_setAttrib(result, R_RowNamesSymbol, compactRowNames);
+  ShieldSEXP cls = Rf_allocVector(STRSXP, 3);
+  SET_STRING_ELT(cls, 0, Rf_mkChar("tbl_df"));
+  SET_STRING_ELT(cls, 1, Rf_mkChar("tbl"));
+  SET_STRING_ELT(cls, 2, Rf_mkChar("data.frame"));
+  Rf_setAttrib(result, R_ClassSymbol, cls);
+  return result;
 }
 
 static void initDataFrame(DataFrameInfo *info) {
   PrSEXP dataFrame = info->initialDataFrame;
-  info->equalityVector = getEqualityVector(dataFrame);
+  setEqualityVector(info, dataFrame);
+  info->columnFingerprints = getColumnFingerprints(dataFrame);
+  info->columnSummaries = R_NilValue;
   getDataFrameStorageEnv().assign(std::to_string(info->uniqueIndex), dataFrame);
+  ShieldSEXP converted = convertPlainDataFrame(dataFrame);
+  if (converted != R_NilValue) {
+    info->dataFrame = converted;
+    info->estimatedSize = estimateOwnedSize(converted, info->initialDataFrame);
+    return;
+  }
   if (Rf_isMatrix(dataFrame)) {
     dataFrame = RI->dataFrame(dataFrame, named("stringsAsFactors", false));
   }
@@ -111,12 +395,57 @@ static void initDataFrame(DataFrameInfo *info) {
   }
 
   info->dataFrame = dataFrame;
+  info->estimatedSize = estimateOwnedSize(dataFrame, info->initialDataFrame);
+}
+
+// Marks the table as the most recently used one and restores it if it was evicted.
+// Returns nullptr if the table has changed since the client has seen it and `acceptChanges` is false
+static DataFrameInfo *useDataFrame(DataFrameInfo *info, bool acceptChanges = false) {
+  if (info == nullptr) return nullptr;
+  if (!info->isInLru) {
+    if (!info->isEvicted) return info;
+    // A view of an evicted table, its row indices are only valid if the base table hasn't changed
+    DataFrameInfo *base = useDataFrame(getBaseDataFrame(info));
+    if (base == nullptr) return nullptr;
+    info->dataFrame = base->dataFrame;
+    info->isEvicted = false;
+    return info;
+  }
+  dataFrameLru.splice(dataFrameLru.end(), dataFrameLru, info->lruPosition);
+  if (info->isEvicted) {
+    // If the variable is gone or is not a table anymore, the last snapshot is shown
+    PrSEXP table = info->initialDataFrame;
+    try {
+      ShieldSEXP newTable = info->refresher();
+      if (isSupportedDataFrame(newTable)) table = newTable;
+    } catch (RError const&) {
+    } catch (RInvalidArgument const&) {
+    }
+    std::vector<SEXP> oldEqualityVector = std::move(info->equalityVector);
+    info->initialDataFrame = table;
+    initDataFrame(info);
+    info->isEvicted = false;
+    if (info->equalityVector != oldEqualityVector) {
+      info->hasUnreportedChanges = true;
+      // The views refer to the rows of the old table, they can't be restored anymore
+      for (DataFrameInfo *view : info->views) view->baseIndex = 0;
+      info->views.clear();
+    }
+    evictDataFrames(info);
+  }
+  return info->hasUnreportedChanges && !acceptChanges ? nullptr : info;
 }
 
-static DataFrameInfo *getDataFrameByRef(RRef const* ref) {
+// The changes of a restored table are reported as FAILED_PRECONDITION, upon which the client is expected
+// to call `dataFrameRefresh` and reload the table
+static DataFrameInfo *getDataFrameByRef(RRef const* ref, bool acceptChanges = false) {
   ShieldSEXP ptr = rpiService->dereference(*ref);
   if (ptr.type() != EXTPTRSXP) return nullptr;
-  return (DataFrameInfo*)R_ExternalPtrAddr(ptr);
+  DataFrameInfo *info = useDataFrame((DataFrameInfo*)R_ExternalPtrAddr(ptr), true);
+  if (info != nullptr && info->hasUnreportedChanges && !acceptChanges) {
+    throw AsyncCallError{Status(grpc::StatusCode::FAILED_PRECONDITION, "Data frame has changed, it must be refreshed")};
+  }
+  return info;
 }
 
 static DataFrameInfo *getDataFrameByRefIndex(int index) {
@@ -130,10 +459,11 @@ DataFrameInfo *registerDataFrame(SEXP x, bool isTemporary) {
   SHIELD(x);
   if (!isTemporary) {
     auto equalityVector = getEqualityVector(x);
-    for (auto const& p : dataFrameCache) {
-      DataFrameInfo *info = p.second;
+    auto range = dataFrameIndex.equal_range(hashEqualityVector(equalityVector));
+    for (auto it = range.first; it != range.second; ++it) {
+      DataFrameInfo *info = it->second;
       if (info == getDataFrameByRefIndex(info->refIndex) && info->equalityVector == equalityVector) {
-        return info;
+        return useDataFrame(info, true);
       }
     }
   }
@@ -146,12 +476,39 @@ DataFrameInfo *registerDataFrame(SEXP x, bool isTemporary) {
   } else {
     dataFrameCache[info->uniqueIndex] = info;
     initDataFrame(info);
+    info->isInLru = true;
+    info->lruPosition = dataFrameLru.insert(dataFrameLru.end(), info);
   }
 
   info->refIndex = rpiService->persistentRefStorage.add(extPtr);
+  if (!isTemporary) evictDataFrames(info);
+  return info;
+}
+
+static DataFrameInfo *registerDataFrameView(DataFrameInfo *base, std::vector<int> rowIndex) {
+  DataFrameInfo *root = base->isInLru ? base : getBaseDataFrame(base);
+  DataFrameInfo *info = registerDataFrame(base->dataFrame, true);
+  info->hasRowIndex = true;
+  info->rowIndex = std::move(rowIndex);
+  if (root != nullptr) {
+    info->baseIndex = root->uniqueIndex;
+    root->views.insert(info);
+  }
   return info;
 }
 
+static int getRowCount(DataFrameInfo *info) {
+  return info->hasRowIndex ? (int)info->rowIndex.size() : asInt(RI->nrow(info->dataFrame));
+}
+
+// Indices of the rows of `info->dataFrame` which are shown by the view
+static std::vector<int> getRows(DataFrameInfo *info) {
+  if (info->hasRowIndex) return info->rowIndex;
+  std::vector<int> rows(asInt(RI->nrow(info->dataFrame)));
+  for (int i = 0; i < (int)rows.size(); ++i) rows[i] = i;
+  return rows;
+}
+
 static void createRefresher(DataFrameInfo *info, const RRef* _ref) {
   RRef ref;
   ref.CopyFrom(*_ref);
@@ -204,16 +561,15 @@ static void createRefresher(DataFrameInfo *info, const RRef* _ref) {
   info->refresher = [=] { return rpiService->dereference(ref); };
 }
 
-Status RPIServiceImpl::dataFrameRegister(ServerContext* context, const RRef* request, Int32Value* response) {
+ServerUnaryReactor* RPIServiceImpl::dataFrameRegister(CallbackServerContext* context, const RRef* request, Int32Value* response) {
   response->set_value(-1);
-  executeOnMainThread([&] {
+  return executeOnMainThreadAsync(context, [=] {
     if (!initDplyr()) return;
     PrSEXP dataFrame = dereference(*request);
     DataFrameInfo *info = registerDataFrame(dataFrame);
     createRefresher(info, request);
     response->set_value(info->refIndex);
-  }, context, true);
-  return Status::OK;
+  });
 }
 
 static std::string getClasses(SEXP obj) {
@@ -221,14 +577,14 @@ static std::string getClasses(SEXP obj) {
   return asStringUTF8(RI->paste(RI->classes(obj), named("collapse", ",")));
 }
 
-Status RPIServiceImpl::dataFrameGetInfo(ServerContext* context, const RRef* request, DataFrameInfoResponse* response) {
-  executeOnMainThread([&] {
+ServerUnaryReactor* RPIServiceImpl::dataFrameGetInfo(CallbackServerContext* context, const RRef* request, DataFrameInfoResponse* response) {
+  return executeOnMainThreadAsync(context, [=] {
     if (!initDplyr()) return;
     DataFrameInfo *info = getDataFrameByRef(request);
     if (info == nullptr) return;
     ShieldSEXP dataFrame = info->dataFrame;
     response->set_canrefresh(bool(info->refresher));
-    response->set_nrows(asInt(RI->nrow(dataFrame)));
+    response->set_nrows(getRowCount(info));
     ShieldSEXP names = RI->names(dataFrame);
     int ncol = asInt(RI->ncol(dataFrame));
     for (int i = 0; i < ncol; ++i) {
@@ -256,198 +612,863 @@ Status RPIServiceImpl::dataFrameGetInfo(ServerContext* context, const RRef* requ
                                  Rf_inherits(column, "POSIXt"));
       }
     }
-  }, context, true);
-  return Status::OK;
+  });
+}
+
+static std::string formatDouble(double x) {
+  if (ISNAN(x)) return "NaN";
+  if (x == R_PosInf) return "Inf";
+  if (x == R_NegInf) return "-Inf";
+  char buf[32];
+  snprintf(buf, sizeof(buf), "%.15g", x);
+  return buf;
+}
+
+static std::string formatComplex(Rcomplex x) {
+  std::string result = formatDouble(x.r);
+  if (ISNAN(x.i) || x.i >= 0) result += '+';
+  return result + formatDouble(x.i) + 'i';
+}
+
+// Maps a row of the view to a row of the column, rows out of range are mapped to `length`
+static R_xlen_t getColumnRow(std::vector<int> const* rowIndex, int j, R_xlen_t length) {
+  if (rowIndex == nullptr) return j;
+  return j < (int)rowIndex->size() ? (*rowIndex)[j] : length;
+}
+
+// Reads rows [start, end) of the view from the column: a contiguous range by a region, rows of a sorted
+// or filtered view one by one. Values of the rows out of range are left zero
+template <typename T>
+static std::vector<T> readColumnRows(SEXP column, std::vector<int> const* rowIndex, int start, int end) {
+  R_xlen_t length = Rf_xlength(column);
+  std::vector<T> values(end - start);
+  if (rowIndex == nullptr) {
+    if (start < length) getVectorRegion<T>(column, start, std::min<R_xlen_t>(end, length) - start, values.data());
+  } else {
+    VectorReader<T> reader(column);
+    for (int j = start; j < end; ++j) {
+      R_xlen_t row = getColumnRow(rowIndex, j, length);
+      if (row < length) values[j - start] = reader[row];
+    }
+  }
+  return values;
+}
+
+// Reads values of plain atomic vectors and factors natively, without evaluating R code per cell.
+// Returns false if the column has a class that has to be formatted by R.
+static bool getColumnDataNative(SEXP column, std::vector<int> const* rowIndex, int start, int end,
+                                DataFrameGetDataResponse::Column* columnProto) {
+  bool isFactor = TYPEOF(column) == INTSXP && Rf_inherits(column, "factor");
+  if (OBJECT(column) && !isFactor) return false;
+  R_xlen_t length = Rf_xlength(column);
+  switch (TYPEOF(column)) {
+    case INTSXP: {
+      std::vector<int> data = readColumnRows<int>(column, rowIndex, start, end);
+      ShieldSEXP levels = isFactor ? Rf_getAttrib(column, R_LevelsSymbol) : R_NilValue;
+      for (int j = start; j < end; ++j) {
+        R_xlen_t row = getColumnRow(rowIndex, j, length);
+        int value = data[j - start];
+        if (row >= length || value == NA_INTEGER) {
+          columnProto->add_values()->mutable_na();
+        } else if (isFactor) {
+          columnProto->add_values()->set_stringvalue(stringEltUTF8(levels, value - 1));
+        } else {
+          columnProto->add_values()->set_intvalue(value);
+        }
+      }
+      return true;
+    }
+    case REALSXP: {
+      std::vector<double> data = readColumnRows<double>(column, rowIndex, start, end);
+      for (int j = start; j < end; ++j) {
+        R_xlen_t row = getColumnRow(rowIndex, j, length);
+        if (row >= length || R_IsNA(data[j - start])) {
+          columnProto->add_values()->mutable_na();
+        } else {
+          columnProto->add_values()->set_doublevalue(data[j - start]);
+        }
+      }
+      return true;
+    }
+    case LGLSXP: {
+      std::vector<int> data = readColumnRows<int>(column, rowIndex, start, end);
+      for (int j = start; j < end; ++j) {
+        R_xlen_t row = getColumnRow(rowIndex, j, length);
+        if (row >= length || data[j - start] == NA_LOGICAL) {
+          columnProto->add_values()->mutable_na();
+        } else {
+          columnProto->add_values()->set_booleanvalue(data[j - start]);
+        }
+      }
+      return true;
+    }
+    case STRSXP: {
+      for (int j = start; j < end; ++j) {
+        R_xlen_t row = getColumnRow(rowIndex, j, length);
+        if (row >= length || STRING_ELT(column, row) == NA_STRING) {
+          columnProto->add_values()->mutable_na();
+        } else {
+          columnProto->add_values()->set_stringvalue(Rf_translateCharUTF8(STRING_ELT(column, row)));
+        }
+      }
+      return true;
+    }
+    case CPLXSXP: {
+      std::vector<Rcomplex> data = readColumnRows<Rcomplex>(column, rowIndex, start, end);
+      for (int j = start; j < end; ++j) {
+        R_xlen_t row = getColumnRow(rowIndex, j, length);
+        if (row >= length || R_IsNA(data[j - start].r)) {
+          columnProto->add_values()->mutable_na();
+        } else {
+          columnProto->add_values()->set_stringvalue(formatComplex(data[j - start]));
+        }
+      }
+      return true;
+    }
+    default:
+      return false;
+  }
+}
+
+static void getColumnDataFallback(SEXP wholeColumn, std::vector<int> const* rowIndex, int start, int end,
+                                  DataFrameGetDataResponse::Column* columnProto) {
+  if (start >= end) return;
+  ShieldSEXP rows = rowIndex == nullptr ? RI->colon(start + 1, end) : Rf_allocVector(INTSXP, end - start);
+  if (rowIndex != nullptr) {
+    for (int j = start; j < end; ++j) {
+      INTEGER(rows)[j - start] = j < (int)rowIndex->size() ? (*rowIndex)[j] + 1 : NA_INTEGER;
+    }
+  }
+  ShieldSEXP column = RI->subscript(wholeColumn, rows);
+  for (int j = 0; j < column.length(); ++j) {
+    if (column.isNA(j)) {
+      columnProto->add_values()->mutable_na();
+    } else {
+      columnProto->add_values()->set_stringvalue(
+        asStringUTF8(RI->paste(RI->doubleSubscript(column, j + 1), named("collapse", "; "))));
+    }
+  }
 }
 
-Status RPIServiceImpl::dataFrameGetData(ServerContext* context, const DataFrameGetDataRequest* request, DataFrameGetDataResponse* response) {
-  executeOnMainThread([&] {
+ServerUnaryReactor* RPIServiceImpl::dataFrameGetData(CallbackServerContext* context, const DataFrameGetDataRequest* request, DataFrameGetDataResponse* response) {
+  return executeOnMainThreadAsync(context, [=] {
     if (!initDplyr()) return;
     DataFrameInfo *info = getDataFrameByRef(&request->ref());
     if (info == nullptr) return;
     ShieldSEXP dataFrame = info->dataFrame;
     int start = request->start();
     int end = request->end();
-    int ncol = asInt(RI->ncol(dataFrame));
+    if (start < 0) start = 0;
+    if (end < start) end = start;
+    std::vector<int> const* rowIndex = info->hasRowIndex ? &info->rowIndex : nullptr;
+    int ncol = dataFrame.length();
     for (int i = 0; i < ncol; ++i) {
       DataFrameGetDataResponse::Column* columnProto = response->add_columns();
-      ShieldSEXP wholeColumn = RI->doubleSubscript(dataFrame, i + 1);
-      ShieldSEXP column = RI->subscript(wholeColumn, RI->colon(start + 1, end));
-      std::string cls = getClasses(column);
-      if (cls == "integer") {
-        for (int j = 0; j < column.length(); ++j) {
-          if (column.isNA(j)) {
-            columnProto->add_values()->mutable_na();
-          } else {
-            columnProto->add_values()->set_intvalue(asInt(column[j]));
-          }
-        }
-      } else if (cls == "numeric") {
-        for (int j = 0; j < column.length(); ++j) {
-          if (column.isNA(j)) {
-            columnProto->add_values()->mutable_na();
-          } else {
-            columnProto->add_values()->set_doublevalue(asDouble(column[j]));
-          }
-        }
-      } else if (cls == "logical") {
-        for (int j = 0; j < column.length(); ++j) {
-          if (column.isNA(j)) {
-            columnProto->add_values()->mutable_na();
-          } else {
-            columnProto->add_values()->set_booleanvalue(asBool(column[j]));
-          }
-        }
-      } else {
-        for (int j = 0; j < column.length(); ++j) {
-          if (column.isNA(j)) {
-            columnProto->add_values()->mutable_na();
-          } else {
-            columnProto->add_values()->set_stringvalue(
-              asStringUTF8(RI->paste(RI->doubleSubscript(column, j + 1), named("collapse", "; "))));
-          }
-        }
+      SEXP column = VECTOR_ELT(dataFrame, i);
+      if (!getColumnDataNative(column, rowIndex, start, end, columnProto)) {
+        getColumnDataFallback(column, rowIndex, start, end, columnProto);
       }
     }
-  }, context, true);
-  return Status::OK;
+  });
 }
 
-Status RPIServiceImpl::dataFrameSort(ServerContext* context, const DataFrameSortRequest* request, Int32Value* response) {
+// A sort key reads either the column itself or, for the classes that R orders by `xtfrm`
+// (e.g. characters which are compared using the collation of the current locale), its ranks
+// An ALTREP column without a buffer is copied for the time of sorting, so it's not materialised in the user's table
+struct DataFrameSortKey {
+  PrSEXP values;
+  const int* ints = nullptr;
+  const double* doubles = nullptr;
+  std::vector<int> intsCopy;
+  std::vector<double> doublesCopy;
+  bool descending = false;
+
+  DataFrameSortKey(SEXP column, bool descending) : descending(descending) {
+    bool isPlain = !OBJECT(column) || (TYPEOF(column) == INTSXP && Rf_inherits(column, "factor"));
+    values = isPlain && (TYPEOF(column) == INTSXP || TYPEOF(column) == LGLSXP || TYPEOF(column) == REALSXP)
+        ? column : RI->xtfrm(column);
+    switch (TYPEOF(values)) {
+      case INTSXP:
+      case LGLSXP: ints = VectorReader<int>(values).getAll(intsCopy); break;
+      case REALSXP: doubles = VectorReader<double>(values).getAll(doublesCopy); break;
+      default: RI->stop("Column can't be sorted");
+    }
+  }
+
+  // Same as `dplyr::arrange`: NAs always come last
+  int compare(int a, int b) const {
+    int result;
+    if (ints != nullptr) {
+      int x = ints[a], y = ints[b];
+      if (x == NA_INTEGER || y == NA_INTEGER) return (x == NA_INTEGER) - (y == NA_INTEGER);
+      result = (x > y) - (x < y);
+    } else {
+      double x = doubles[a], y = doubles[b];
+      if (ISNAN(x) || ISNAN(y)) return (int)ISNAN(x) - (int)ISNAN(y);
+      result = (x > y) - (x < y);
+    }
+    return descending ? -result : result;
+  }
+};
+
+ServerUnaryReactor* RPIServiceImpl::dataFrameSort(CallbackServerContext* context, const DataFrameSortRequest* request, Int32Value* response) {
   response->set_value(-1);
-  executeOnMainThread([&] {
+  return executeOnMainThreadAsync(context, [=] {
     if (!initDplyr()) return;
     DataFrameInfo *info = getDataFrameByRef(&request->ref());
     if (info == nullptr) return;
     ShieldSEXP dataFrame = info->dataFrame;
-    std::vector<PrSEXP> arrangeArgs = {dataFrame};
+    std::vector<DataFrameSortKey> keys;
+    // The keys may point into their own copies of the columns, so they must not be relocated
+    keys.reserve(request->keys_size());
     for (auto const& key : request->keys()) {
-      if (key.descending()) {
-        arrangeArgs.emplace_back(RI->dplyrDesc(RI->doubleSubscript(dataFrame, key.columnindex() + 1)));
-      } else {
-        arrangeArgs.emplace_back(RI->doubleSubscript(dataFrame, key.columnindex() + 1));
-      }
+      if (key.columnindex() < 0 || key.columnindex() >= dataFrame.length()) return;
+      keys.emplace_back(VECTOR_ELT(dataFrame, key.columnindex()), key.descending());
     }
-    DataFrameInfo *newInfo = registerDataFrame(invokeFunction(RI->dplyrArrange, arrangeArgs), true);
+    std::vector<int> rows = getRows(info);
+    std::stable_sort(rows.begin(), rows.end(), [&](int a, int b) {
+      for (auto const& key : keys) {
+        int result = key.compare(a, b);
+        if (result != 0) return result < 0;
+      }
+      return false;
+    });
+    DataFrameInfo *newInfo = registerDataFrameView(info, std::move(rows));
     response->set_value(newInfo->refIndex);
-  }, context, true);
-  return Status::OK;
+  });
+}
+
+// Result of a filter over the rows of a view, in R's three-valued logic (TRUE, FALSE or NA).
+// Each row has a bit in `isTrue` and in `isFalse`, a row with neither is NA
+class FilterMask {
+public:
+  FilterMask(int size, bool value) :
+    size(size),
+    isTrue((size + 63) / 64, value ? ~(uint64_t)0 : 0),
+    isFalse((size + 63) / 64, value ? 0 : ~(uint64_t)0) {
+  }
+
+  // `value` is TRUE, FALSE or NA_LOGICAL
+  void set(int i, int value) {
+    uint64_t bit = (uint64_t)1 << (i % 64);
+    isTrue[i / 64] = value == TRUE ? isTrue[i / 64] | bit : isTrue[i / 64] & ~bit;
+    isFalse[i / 64] = value == FALSE ? isFalse[i / 64] | bit : isFalse[i / 64] & ~bit;
+  }
+
+  bool get(int i) const {
+    return (isTrue[i / 64] >> (i % 64)) & 1;
+  }
+
+  void andWith(FilterMask const& other) {
+    for (size_t i = 0; i < isTrue.size(); ++i) {
+      isTrue[i] &= other.isTrue[i];
+      isFalse[i] |= other.isFalse[i];
+    }
+  }
+
+  void orWith(FilterMask const& other) {
+    for (size_t i = 0; i < isTrue.size(); ++i) {
+      isTrue[i] |= other.isTrue[i];
+      isFalse[i] &= other.isFalse[i];
+    }
+  }
+
+  void negate() {
+    std::swap(isTrue, isFalse);
+  }
+
+  int getSize() const {
+    return size;
+  }
+
+private:
+  int size;
+  std::vector<uint64_t> isTrue;
+  std::vector<uint64_t> isFalse;
+};
+
+static FilterMask filterMaskFromLogical(SEXP x, std::vector<int> const& rows) {
+  SHIELD(x);
+  FilterMask mask((int)rows.size(), false);
+  if (TYPEOF(x) != LGLSXP) return mask;
+  int length = (int)Rf_xlength(x);
+  VectorReader<int> values(x);
+  for (int i = 0; i < (int)rows.size(); ++i) {
+    mask.set(i, rows[i] < length ? values[rows[i]] : NA_LOGICAL);
+  }
+  return mask;
+}
+
+static int compareForFilter(DataFrameFilterRequest_Filter_Operator_Type type, int cmp) {
+  switch (type) {
+    case DataFrameFilterRequest_Filter_Operator_Type_EQ: return cmp == 0;
+    case DataFrameFilterRequest_Filter_Operator_Type_NEQ: return cmp != 0;
+    case DataFrameFilterRequest_Filter_Operator_Type_LESS: return cmp < 0;
+    case DataFrameFilterRequest_Filter_Operator_Type_GREATER: return cmp > 0;
+    case DataFrameFilterRequest_Filter_Operator_Type_LEQ: return cmp <= 0;
+    case DataFrameFilterRequest_Filter_Operator_Type_GEQ: return cmp >= 0;
+    default: return TRUE;
+  }
+}
+
+static bool isPlainColumn(SEXP column) {
+  return !OBJECT(column) && Rf_getAttrib(column, R_DimSymbol) == R_NilValue;
+}
+
+static bool isFactorColumn(SEXP column) {
+  return TYPEOF(column) == INTSXP && Rf_inherits(column, "factor") &&
+         TYPEOF(Rf_getAttrib(column, R_LevelsSymbol)) == STRSXP;
+}
+
+static bool isSameString(SEXP a, const char* b) {
+  return !strcmp(Rf_translateCharUTF8(a), b);
+}
+
+// Same as `grepl(pattern, column)` for character vectors and factors, but the pattern is matched
+// only once against each distinct string of the view instead of against every row
+static bool applyRegexFilter(SEXP column, std::vector<int> const& rows, std::string const& pattern, FilterMask& mask) {
+  bool isFactor = isFactorColumn(column);
+  if (!isFactor && !(TYPEOF(column) == STRSXP && isPlainColumn(column))) return false;
+  ShieldSEXP levels = isFactor ? Rf_getAttrib(column, R_LevelsSymbol) : R_NilValue;
+  std::unordered_map<SEXP, int> distinct;
+  std::vector<int> rowToDistinct(rows.size(), -1);
+  if (!isFactor) {
+    for (int i = 0; i < (int)rows.size(); ++i) {
+      SEXP s = STRING_ELT(column, rows[i]);
+      if (s == NA_STRING) continue;
+      rowToDistinct[i] = distinct.emplace(s, (int)distinct.size()).first->second;
+    }
+  }
+  ShieldSEXP strings = isFactor ? (SEXP)levels : Rf_allocVector(STRSXP, distinct.size());
+  if (!isFactor) {
+    for (auto const& it : distinct) SET_STRING_ELT(strings, it.second, it.first);
+  }
+  ShieldSEXP matches = RI->grepl(pattern, strings);
+  if (TYPEOF(matches) != LGLSXP) return false;
+  int nlevels = (int)Rf_xlength(matches);
+  VectorReader<int> codes(column);
+  for (int i = 0; i < (int)rows.size(); ++i) {
+    int index = isFactor ? codes[rows[i]] - 1 : rowToDistinct[i];
+    // `grepl` never returns NA
+    mask.set(i, index >= 0 && index < nlevels && LOGICAL(matches)[index] == TRUE);
+  }
+  return true;
+}
+
+static bool applyOperatorFilterNative(SEXP column, std::string const& cls, std::vector<int> const& rows,
+                                      DataFrameFilterRequest::Filter::Operator const& op, FilterMask& mask) {
+  auto type = op.type();
+  if (type == DataFrameFilterRequest_Filter_Operator_Type_REGEX) {
+    return applyRegexFilter(column, rows, op.value(), mask);
+  }
+  if (cls == "integer" || cls == "logical") {
+    ShieldSEXP valueVector = cls == "integer" ? RI->asInteger(op.value()) : RI->asLogical(op.value());
+    int value = TYPEOF(valueVector) == INTSXP ? INTEGER(valueVector)[0] : LOGICAL(valueVector)[0];
+    VectorReader<int> values(column);
+    for (int i = 0; i < (int)rows.size(); ++i) {
+      int x = values[rows[i]];
+      mask.set(i, x == NA_INTEGER || value == NA_INTEGER ? NA_LOGICAL : compareForFilter(type, (x > value) - (x < value)));
+    }
+    return true;
+  }
+  if (cls == "numeric") {
+    double value = asDouble(RI->asDouble(op.value()));
+    VectorReader<double> values(column);
+    for (int i = 0; i < (int)rows.size(); ++i) {
+      double x = values[rows[i]];
+      mask.set(i, ISNAN(x) || ISNAN(value) ? NA_LOGICAL : compareForFilter(type, (x > value) - (x < value)));
+    }
+    return true;
+  }
+  // Ordering of strings depends on the collation of the locale, leave it to R
+  if (type != DataFrameFilterRequest_Filter_Operator_Type_EQ && type != DataFrameFilterRequest_Filter_Operator_Type_NEQ) {
+    return false;
+  }
+  const char* value = op.value().c_str();
+  if (isFactorColumn(column)) {
+    SEXP levels = Rf_getAttrib(column, R_LevelsSymbol);
+    std::vector<int> levelResults(Rf_xlength(levels));
+    for (int j = 0; j < (int)levelResults.size(); ++j) {
+      SEXP level = STRING_ELT(levels, j);
+      levelResults[j] = level == NA_STRING ? NA_LOGICAL : compareForFilter(type, !isSameString(level, value));
+    }
+    VectorReader<int> codes(column);
+    for (int i = 0; i < (int)rows.size(); ++i) {
+      int code = codes[rows[i]];
+      mask.set(i, code >= 1 && code <= (int)levelResults.size() ? levelResults[code - 1] : NA_LOGICAL);
+    }
+    return true;
+  }
+  if (cls == "character") {
+    ShieldSEXP valueChar = Rf_mkCharCE(value, CE_UTF8);
+    for (int i = 0; i < (int)rows.size(); ++i) {
+      SEXP x = STRING_ELT(column, rows[i]);
+      mask.set(i, x == NA_STRING ? NA_LOGICAL : compareForFilter(type, x != (SEXP)valueChar && !isSameString(x, value)));
+    }
+    return true;
+  }
+  return false;
+}
+
+// Same as `is.na(column)`: NaN is NA too, and a complex value is NA if either of its parts is
+static bool applyNaFilterNative(SEXP column, std::vector<int> const& rows, FilterMask& mask) {
+  int size = (int)rows.size();
+  switch (TYPEOF(column)) {
+    case INTSXP:
+    case LGLSXP: {
+      VectorReader<int> values(column);
+      for (int i = 0; i < size; ++i) mask.set(i, values[rows[i]] == NA_INTEGER);
+      return true;
+    }
+    case REALSXP: {
+      VectorReader<double> values(column);
+      for (int i = 0; i < size; ++i) mask.set(i, ISNAN(values[rows[i]]));
+      return true;
+    }
+    case CPLXSXP: {
+      VectorReader<Rcomplex> values(column);
+      for (int i = 0; i < size; ++i) {
+        Rcomplex x = values[rows[i]];
+        mask.set(i, ISNAN(x.r) || ISNAN(x.i));
+      }
+      return true;
+    }
+    case STRSXP:
+      for (int i = 0; i < size; ++i) mask.set(i, STRING_ELT(column, rows[i]) == NA_STRING);
+      return true;
+    case RAWSXP:
+      for (int i = 0; i < size; ++i) mask.set(i, false);
+      return true;
+    default:
+      return false;
+  }
 }
 
-static SEXP applyFilter(SEXP df, DataFrameFilterRequest::Filter const& filter) {
-  SHIELD(df);
-  int nrow = asInt(RI->nrow(df));
-  if (filter.has_true_()) {
-    return RI->rep(true, nrow);
+static SEXP applyOperatorFilterInR(SEXP column, std::string const& cls, DataFrameFilterRequest::Filter::Operator const& op) {
+  SHIELD(column);
+  std::string const& strValue = op.value();
+  PrSEXP value;
+  if (cls == "integer") {
+    value = RI->asInteger(strValue);
+  } else if (cls == "numeric") {
+    value = RI->asDouble(strValue);
+  } else if (cls == "logical") {
+    value = RI->asLogical(strValue);
+  } else {
+    value = toSEXP(strValue);
+  }
+  switch (op.type()) {
+    case DataFrameFilterRequest_Filter_Operator_Type_EQ:
+      return RI->eq(column, value);
+    case DataFrameFilterRequest_Filter_Operator_Type_NEQ:
+      return RI->neq(column, value);
+    case DataFrameFilterRequest_Filter_Operator_Type_LESS:
+      return RI->less(column, value);
+    case DataFrameFilterRequest_Filter_Operator_Type_GREATER:
+      return RI->greater(column, value);
+    case DataFrameFilterRequest_Filter_Operator_Type_LEQ:
+      return RI->leq(column, value);
+    case DataFrameFilterRequest_Filter_Operator_Type_GEQ:
+      return RI->geq(column, value);
+    case DataFrameFilterRequest_Filter_Operator_Type_REGEX:
+      return RI->grepl(strValue, column);
+    default:
+      return R_NilValue;
   }
+}
+
+static FilterMask applyFilter(SEXP df, std::vector<int> const& rows, DataFrameFilterRequest::Filter const& filter) {
+  int size = (int)rows.size();
   if (filter.has_composed()) {
     switch (filter.composed().type()) {
       case DataFrameFilterRequest_Filter_ComposedFilter_Type_AND: {
-        PrSEXP result = RI->rep(true, nrow);
+        FilterMask result(size, true);
         for (auto const& f : filter.composed().filters()) {
-          result = RI->vectorAnd(result, applyFilter(df, f));
+          result.andWith(applyFilter(df, rows, f));
         }
         return result;
       }
       case DataFrameFilterRequest_Filter_ComposedFilter_Type_OR: {
-        PrSEXP result = RI->rep(false, nrow);
+        FilterMask result(size, false);
         for (auto const& f : filter.composed().filters()) {
-          result = RI->vectorOr(result, applyFilter(df, f));
+          result.orWith(applyFilter(df, rows, f));
         }
         return result;
       }
       case DataFrameFilterRequest_Filter_ComposedFilter_Type_NOT: {
-        PrSEXP result = RI->rep(true, nrow);
+        FilterMask result(size, true);
         for (auto const& f : filter.composed().filters()) {
-          result = RI->vectorAnd(result, applyFilter(df, f));
+          result.andWith(applyFilter(df, rows, f));
         }
-        return RI->vectorNot(result);
+        result.negate();
+        return result;
       }
       default:
-        return RI->rep(true, nrow);
+        return FilterMask(size, true);
     }
   }
   if (filter.has_operator_()) {
-    ShieldSEXP column = RI->doubleSubscript(df, filter.operator_().column() + 1);
-    std::string cls = getClasses(column);
-    std::string const& strValue = filter.operator_().value();
-    PrSEXP value;
-    if (cls == "integer") {
-      value = RI->asInteger(strValue);
-    } else if (cls == "numeric") {
-      value = RI->asDouble(strValue);
-    } else if (cls == "logical") {
-      value = RI->asLogical(strValue);
+    int index = filter.operator_().column();
+    if (index < 0 || index >= Rf_xlength(df)) RI->stop("Invalid column index");
+    ShieldSEXP column = VECTOR_ELT(df, index);
+    bool isPlain = isPlainColumn(column);
+    std::string cls;
+    if (isPlain && TYPEOF(column) == INTSXP) {
+      cls = "integer";
+    } else if (isPlain && TYPEOF(column) == REALSXP) {
+      cls = "numeric";
+    } else if (isPlain && TYPEOF(column) == LGLSXP) {
+      cls = "logical";
+    } else if (isPlain && TYPEOF(column) == STRSXP) {
+      cls = "character";
     } else {
-      value = toSEXP(strValue);
-    }
-    switch (filter.operator_().type()) {
-      case DataFrameFilterRequest_Filter_Operator_Type_EQ:
-        return RI->eq(column, value);
-      case DataFrameFilterRequest_Filter_Operator_Type_NEQ:
-        return RI->neq(column, value);
-      case DataFrameFilterRequest_Filter_Operator_Type_LESS:
-        return RI->less(column, value);
-      case DataFrameFilterRequest_Filter_Operator_Type_GREATER:
-        return RI->greater(column, value);
-      case DataFrameFilterRequest_Filter_Operator_Type_LEQ:
-        return RI->leq(column, value);
-      case DataFrameFilterRequest_Filter_Operator_Type_GEQ:
-        return RI->geq(column, value);
-      case DataFrameFilterRequest_Filter_Operator_Type_REGEX:
-        try {
-          return RI->grepl(strValue, column);
-        } catch (RError const&) {
-        }
-      default:
-        return RI->rep(true, nrow);
+      cls = getClasses(column);
+      // e.g. an integer column with a class attribute is no longer compared as a plain integer
+      isPlain = false;
+    }
+    FilterMask result(size, true);
+    try {
+      if ((isPlain || isFactorColumn(column)) && applyOperatorFilterNative(column, cls, rows, filter.operator_(), result)) {
+        return result;
+      }
+      return filterMaskFromLogical(applyOperatorFilterInR(column, cls, filter.operator_()), rows);
+    } catch (RError const&) {
+      // Invalid regular expression
+      if (filter.operator_().type() != DataFrameFilterRequest_Filter_Operator_Type_REGEX) throw;
+      return FilterMask(size, true);
     }
   }
   if (filter.has_nafilter()) {
-    ShieldSEXP column = RI->doubleSubscript(df, filter.nafilter().column() + 1);
-    if (filter.nafilter().isna()) {
-      return RI->isNa(column);
-    } else {
-      return RI->vectorNot(RI->isNa(column));
+    int index = filter.nafilter().column();
+    if (index < 0 || index >= Rf_xlength(df)) RI->stop("Invalid column index");
+    ShieldSEXP column = VECTOR_ELT(df, index);
+    FilterMask result(size, false);
+    // is.na() of a list checks its elements, so lists go through R
+    if (!((isPlainColumn(column) && Rf_isVectorAtomic(column)) || isFactorColumn(column)) ||
+        !applyNaFilterNative(column, rows, result)) {
+      result = filterMaskFromLogical(RI->isNa(column), rows);
     }
+    if (!filter.nafilter().isna()) result.negate();
+    return result;
   }
-  return RI->rep(true, nrow);
+  return FilterMask(size, true);
 }
 
-Status RPIServiceImpl::dataFrameFilter(ServerContext* context, const DataFrameFilterRequest* request, Int32Value* response) {
+ServerUnaryReactor* RPIServiceImpl::dataFrameFilter(CallbackServerContext* context, const DataFrameFilterRequest* request, Int32Value* response) {
   response->set_value(-1);
-  executeOnMainThread([&] {
+  return executeOnMainThreadAsync(context, [=] {
     if (!initDplyr()) return;
     DataFrameInfo *info = getDataFrameByRef(&request->ref());
     if (info == nullptr) return;
     ShieldSEXP dataFrame = info->dataFrame;
-    ShieldSEXP maskWithNa = applyFilter(dataFrame, request->filter());
-    ShieldSEXP mask = RI->replace(maskWithNa, RI->isNa(maskWithNa), false);
-    PrSEXP call = R_NilValue;
-    for (int i = (int)dataFrame.length() - 1; i >= 0; --i) {
-      call = Rf_lcons(RI->subscript(dataFrame[i], mask), call);
-      SET_TAG(call, Rf_install(std::to_string(i).c_str()));
+    std::vector<int> rows = getRows(info);
+    FilterMask mask = applyFilter(dataFrame, rows, request->filter());
+    std::vector<int> filteredRows;
+    for (int i = 0; i < mask.getSize(); ++i) {
+      if (mask.get(i)) filteredRows.push_back(rows[i]);
     }
-    ShieldSEXP names = RI->names(dataFrame);
-    ShieldSEXP newDataFrame = RI->namesAssign(safeEval(Rf_lcons(RI->dplyrTibble, call), R_GlobalEnv), names);
-
-    DataFrameInfo *newInfo = registerDataFrame(newDataFrame, true);
+    DataFrameInfo *newInfo = registerDataFrameView(info, std::move(filteredRows));
     response->set_value(newInfo->refIndex);
-  }, context, true);
-  return Status::OK;
+  });
+}
+
+const int HLL_PRECISION = 12;
+const int HISTOGRAM_BINS = 32;
+
+static uint64_t mixHash(uint64_t x) {
+  x += 0x9e3779b97f4a7c15ULL;
+  x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+  x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+  return x ^ (x >> 31);
+}
+
+// HyperLogLog estimate of the number of distinct values
+class DistinctCounter {
+public:
+  DistinctCounter() : registers(1 << HLL_PRECISION, 0) {}
+
+  void add(uint64_t value) {
+    uint64_t hash = mixHash(value);
+    size_t index = hash >> (64 - HLL_PRECISION);
+    uint64_t rest = hash << HLL_PRECISION;
+    uint8_t rank = 1;
+    while (rank <= 64 - HLL_PRECISION && !(rest & ((uint64_t)1 << 63))) {
+      rest <<= 1;
+      ++rank;
+    }
+    registers[index] = std::max(registers[index], rank);
+  }
+
+  double estimate() const {
+    double m = (double)registers.size();
+    double sum = 0;
+    int zeros = 0;
+    for (uint8_t r : registers) {
+      sum += std::ldexp(1.0, -r);
+      if (r == 0) ++zeros;
+    }
+    double result = 0.7213 / (1 + 1.079 / m) * m * m / sum;
+    // Linear counting is more precise for small cardinalities
+    if (result <= 2.5 * m && zeros > 0) result = m * std::log(m / zeros);
+    return std::round(result);
+  }
+
+private:
+  std::vector<uint8_t> registers;
+};
+
+// Histogram with a fixed number of equal bins which is built in one pass without knowing the range in advance.
+// When a value falls outside of the current range, neighbouring bins are merged and the range doubles
+class StreamingHistogram {
+public:
+  StreamingHistogram() : counts(HISTOGRAM_BINS, 0) {}
+
+  void add(double x) {
+    if (!R_FINITE(x)) return;
+    if (!hasRange) {
+      if (firstCount == 0 || x == first) {
+        first = x;
+        ++firstCount;
+        return;
+      }
+      hasRange = true;
+      start = std::min(first, x);
+      width = std::max(std::fabs(x - first) / (HISTOGRAM_BINS - 1), DBL_MIN);
+      counts[getBin(first)] += firstCount;
+    }
+    while (x >= start + width * HISTOGRAM_BINS) extendUp();
+    while (x < start) extendDown();
+    ++counts[getBin(x)];
+  }
+
+  SEXP toSEXP() const {
+    int binCount = hasRange ? HISTOGRAM_BINS : firstCount > 0 ? 1 : 0;
+    ShieldSEXP breaks = Rf_allocVector(REALSXP, binCount == 0 ? 0 : binCount + 1);
+    ShieldSEXP binCounts = Rf_allocVector(REALSXP, binCount);
+    if (hasRange) {
+      for (int i = 0; i <= HISTOGRAM_BINS; ++i) REAL(breaks)[i] = start + width * i;
+      for (int i = 0; i < HISTOGRAM_BINS; ++i) REAL(binCounts)[i] = (double)counts[i];
+    } else if (binCount == 1) {
+      REAL(breaks)[0] = REAL(breaks)[1] = first;
+      REAL(binCounts)[0] = (double)firstCount;
+    }
+    return RI->list(named("breaks", breaks), named("counts", binCounts));
+  }
+
+private:
+  bool hasRange = false;
+  double first = 0;
+  long long firstCount = 0;
+  double start = 0;
+  double width = 0;
+  std::vector<long long> counts;
+
+  int getBin(double x) const {
+    double position = (x - start) / width;
+    return position >= HISTOGRAM_BINS ? HISTOGRAM_BINS - 1 : position < 0 ? 0 : (int)position;
+  }
+
+  void extendUp() {
+    for (int i = 0; i < HISTOGRAM_BINS / 2; ++i) counts[i] = counts[2 * i] + counts[2 * i + 1];
+    std::fill(counts.begin() + HISTOGRAM_BINS / 2, counts.end(), 0);
+    width *= 2;
+  }
+
+  void extendDown() {
+    for (int i = HISTOGRAM_BINS - 1; i >= HISTOGRAM_BINS / 2; --i) {
+      int j = i - HISTOGRAM_BINS / 2;
+      counts[i] = counts[2 * j] + counts[2 * j + 1];
+    }
+    std::fill(counts.begin(), counts.begin() + HISTOGRAM_BINS / 2, 0);
+    start -= width * HISTOGRAM_BINS;
+    width *= 2;
+  }
+};
+
+// Number of NAs, estimated number of distinct values and, for numeric columns, range, mean and histogram
+// of the rows of the view. All of them are computed in one pass over the column
+static SEXP computeColumnSummary(SEXP column, std::vector<int> const& rows) {
+  int type = TYPEOF(column);
+  bool isNumeric = (type == INTSXP && !Rf_inherits(column, "factor")) || type == REALSXP || type == LGLSXP;
+  bool isDistinctSupported = true;
+  int naCount = 0;
+  long long count = 0;
+  double min = R_PosInf, max = R_NegInf, sum = 0;
+  DistinctCounter distinct;
+  StreamingHistogram histogram;
+  auto addNumber = [&](double x) {
+    ++count;
+    min = std::min(min, x);
+    max = std::max(max, x);
+    sum += x;
+    histogram.add(x);
+  };
+  for (int row : rows) {
+    switch (type) {
+      case LGLSXP:
+      case INTSXP: {
+        int x = type == INTSXP ? INTEGER_ELT(column, row) : LOGICAL_ELT(column, row);
+        if (x == NA_INTEGER) {
+          ++naCount;
+          continue;
+        }
+        distinct.add((uint64_t)(uint32_t)x);
+        if (isNumeric) addNumber(x);
+        break;
+      }
+      case REALSXP: {
+        double x = REAL_ELT(column, row);
+        if (ISNAN(x)) {
+          ++naCount;
+          continue;
+        }
+        if (x == 0) x = 0; // -0 is the same value
+        uint64_t bits;
+        memcpy(&bits, &x, sizeof(bits));
+        distinct.add(bits);
+        addNumber(x);
+        break;
+      }
+      case CPLXSXP: {
+        Rcomplex x = COMPLEX_ELT(column, row);
+        if (ISNAN(x.r) || ISNAN(x.i)) {
+          ++naCount;
+          continue;
+        }
+        uint64_t bits[2];
+        memcpy(bits, &x, sizeof(bits));
+        distinct.add(bits[0] ^ mixHash(bits[1]));
+        break;
+      }
+      case STRSXP: {
+        SEXP x = STRING_ELT(column, row);
+        if (x == NA_STRING) {
+          ++naCount;
+          continue;
+        }
+        // Strings are cached by R, so equal strings (in the same encoding) share the pointer
+        distinct.add((uint64_t)(uintptr_t)x);
+        break;
+      }
+      default:
+        isDistinctSupported = false;
+        break;
+    }
+  }
+  ShieldSEXP histogramSEXP = isNumeric ? histogram.toSEXP() : R_NilValue;
+  return RI->list(
+    named("naCount", naCount),
+    named("distinct", isDistinctSupported ? distinct.estimate() : NA_REAL),
+    named("min", count > 0 ? min : NA_REAL),
+    named("max", count > 0 ? max : NA_REAL),
+    named("mean", count > 0 ? sum / count : NA_REAL),
+    named("histogram", histogramSEXP));
+}
+
+SEXP getDataFrameColumnSummaries(int refIndex) {
+  DataFrameInfo *info = useDataFrame(getDataFrameByRefIndex(refIndex));
+  if (info == nullptr) RI->stop("Invalid data frame reference");
+  if (info->columnSummaries == R_NilValue) {
+    ShieldSEXP dataFrame = info->dataFrame;
+    std::vector<int> rows = getRows(info);
+    int ncol = (int)dataFrame.length();
+    ShieldSEXP result = Rf_allocVector(VECSXP, ncol);
+    for (int i = 0; i < ncol; ++i) {
+      SET_VECTOR_ELT(result, i, computeColumnSummary(VECTOR_ELT(dataFrame, i), rows));
+    }
+    Rf_setAttrib(result, R_NamesSymbol, Rf_getAttrib(dataFrame, R_NamesSymbol));
+    info->columnSummaries = result;
+  }
+  return info->columnSummaries;
+}
+
+// Replaces only the columns of `info->dataFrame` which differ from the new value of the table,
+// so that appending rows or modifying a few columns doesn't convert the whole table again.
+// Returns false if the table has changed its shape and has to be converted from scratch
+static bool refreshChangedColumns(DataFrameInfo *info, SEXP newTable, bool& hasChanges) {
+  auto const& oldFingerprints = info->columnFingerprints;
+  SEXP oldTable = info->initialDataFrame;
+  SEXP dataFrame = info->dataFrame;
+  if (oldFingerprints.empty() || TYPEOF(newTable) != VECSXP || Rf_isMatrix(newTable) ||
+      Rf_xlength(newTable) != (R_xlen_t)oldFingerprints.size()) {
+    return false;
+  }
+  if (!R_compute_identical(Rf_getAttrib(oldTable, R_NamesSymbol), Rf_getAttrib(newTable, R_NamesSymbol), 16) ||
+      !R_compute_identical(Rf_getAttrib(oldTable, R_ClassSymbol), Rf_getAttrib(newTable, R_ClassSymbol), 16)) {
+    return false;
+  }
+  // Converted table starts with the column of row names which is followed by the columns of the initial table
+  SEXP names = Rf_getAttrib(dataFrame, R_NamesSymbol);
+  if (Rf_xlength(dataFrame) != (R_xlen_t)oldFingerprints.size() + 1 || TYPEOF(names) != STRSXP ||
+      strcmp(stringEltUTF8(names, 0), ROW_NAMES_COL)) {
+    return false;
+  }
+  SEXP oldRowNames = getStoredRowNames(oldTable);
+  SEXP newRowNames = getStoredRowNames(newTable);
+  // Only automatic row names can be extended without calling `rownames_to_column`
+  bool isAutomatic = isCompactRowNames(oldRowNames) && isCompactRowNames(newRowNames);
+  if (!isAutomatic && !R_compute_identical(oldRowNames, newRowNames, 16)) return false;
+
+  std::vector<DataFrameColumnFingerprint> newFingerprints = getColumnFingerprints(newTable);
+  ShieldSEXP result = Rf_shallow_duplicate(dataFrame);
+  for (int i = 0; i < (int)newFingerprints.size(); ++i) {
+    if (newFingerprints[i] == oldFingerprints[i]) continue;
+    hasChanges = true;
+    SEXP column = VECTOR_ELT(newTable, i);
+    if (Rf_inherits(column, "POSIXlt")) {
+      SET_VECTOR_ELT(result, i + 1, RI->asPOSIXct(column));
+    } else {
+      MARK_NOT_MUTABLE(column);
+      SET_VECTOR_ELT(result, i + 1, column);
+    }
+  }
+  if (isAutomatic) {
+    int oldRows = std::abs(INTEGER_ELT(oldRowNames, 1));
+    int newRows = std::abs(INTEGER_ELT(newRowNames, 1));
+    if (oldRows != newRows) {
+      hasChanges = true;
+      SET_VECTOR_ELT(result, 0, getAutomaticRowNamesColumn(newRows));
+      ShieldSEXP compactRowNames = Rf_allocVector(INTSXP, 2);
+      INTEGER(compactRowNames)[0] = NA_INTEGER;
+      INTEGER(compactRowNames)[1] = -newRows;
+      Rf_setAttrib(result, R_RowNamesSymbol, compactRowNames);
+    }
+  }
+
+  info->initialDataFrame = newTable;
+  setEqualityVector(info, newTable);
+  info->columnFingerprints = std::move(newFingerprints);
+  getDataFrameStorageEnv().assign(std::to_string(info->uniqueIndex), newTable);
+  if (hasChanges) {
+    info->dataFrame = result;
+    info->columnSummaries = R_NilValue;
+  }
+  info->estimatedSize = estimateOwnedSize(info->dataFrame, newTable);
+  return true;
 }
 
-Status RPIServiceImpl::dataFrameRefresh(ServerContext* context, const RRef* request, BoolValue* response) {
-  executeOnMainThread([&] {
+ServerUnaryReactor* RPIServiceImpl::dataFrameRefresh(CallbackServerContext* context, const RRef* request, BoolValue* response) {
+  return executeOnMainThreadAsync(context, [=] {
     if (!initDplyr()) return;
-    DataFrameInfo *info = getDataFrameByRef(request);
+    DataFrameInfo *info = getDataFrameByRef(request, true);
     if (info == nullptr) return;
+    if (info->hasUnreportedChanges) {
+      // The table has just been restored from eviction with the new data
+      info->hasUnreportedChanges = false;
+      response->set_value(true);
+      return;
+    }
     if (!info->refresher) return;
     ShieldSEXP newTable = info->refresher();
-    if (!isSupportedDataFrame(newTable) || getEqualityVector(newTable) == info->equalityVector) return;
+    if (!isSupportedDataFrame(newTable)) return;
+    bool hasChanges = false;
+    if (refreshChangedColumns(info, newTable, hasChanges)) {
+      response->set_value(hasChanges);
+      return;
+    }
+    if (getEqualityVector(newTable) == info->equalityVector) return;
     info->initialDataFrame = newTable;
     initDataFrame(info);
     response->set_value(true);
-  }, context, true);
-  return Status::OK;
+  });
 }
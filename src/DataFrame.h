@@ -20,15 +20,53 @@
 #include "RStuff/RInclude.h"
 #include "RStuff/MySEXP.h"
 #include <functional>
+#include <list>
+#include <unordered_set>
+#include <vector>
+
+// Identity of a column of the initial table which is compared on refresh.
+// Sampled content is hashed as well to detect in-place modifications
+struct DataFrameColumnFingerprint {
+  SEXP column;
+  R_xlen_t length;
+  size_t contentHash;
+
+  bool operator == (DataFrameColumnFingerprint const& other) const {
+    return column == other.column && length == other.length && contentHash == other.contentHash;
+  }
+};
 
 struct DataFrameInfo {
   int refIndex;
   int uniqueIndex;
   PrSEXP initialDataFrame;
   std::vector<SEXP> equalityVector;
+  size_t equalityHash = 0;
+  std::vector<DataFrameColumnFingerprint> columnFingerprints;
   PrSEXP dataFrame;
+  // Sorted and filtered views share `dataFrame` with the original table
+  // and only keep the (0-based) indices of their rows in it
+  bool hasRowIndex = false;
+  std::vector<int> rowIndex;
+  // Statistics of the columns of the view, computed on demand and dropped when the table changes
+  PrSEXP columnSummaries;
   std::function<SEXP()> refresher;
   std::function<void()> finalizer;
+  // Position in the list of recently used tables, only for the tables which are not views
+  bool isInLru = false;
+  std::list<DataFrameInfo*>::iterator lruPosition;
+  // Memory which is pinned only by the viewer, the columns shared with the initial table are not counted
+  size_t estimatedSize = 0;
+  // The converted table was released to stay within the memory budget, it's restored by the refresher on the next access
+  // (or from `initialDataFrame` if the refresher fails).
+  // Views are released and restored together with their base table
+  bool isEvicted = false;
+  // The table turned out to be changed when it was restored, which must be reported by the next refresh
+  // before the client gets any data of it
+  bool hasUnreportedChanges = false;
+  // `uniqueIndex` of the base table of a view (0 if none), and the views of a base table
+  int baseIndex = 0;
+  std::unordered_set<DataFrameInfo*> views;
 
   DataFrameInfo();
   ~DataFrameInfo();
@@ -36,5 +74,6 @@ struct DataFrameInfo {
 
 bool isSupportedDataFrame(SEXP x);
 DataFrameInfo *registerDataFrame(SEXP x, bool isTemporary = false);
+SEXP getDataFrameColumnSummaries(int refIndex);
 
 #endif //RWRAPPER_EVENT_LOOP_H
@@ -20,6 +20,7 @@
 #include "RStuff/RInclude.h"
 #include "RStuff/RObjects.h"
 #include "debugger/RDebugger.h"
+#include <atomic>
 
 typedef void (*LaterFunction)(void (*func)(void*), void*, double, int);
 static volatile LaterFunction laterFunc;
@@ -49,3 +50,17 @@ bool executeWithLater(std::function<void()> const& f) {
   }, new std::function<void()>(std::move(f)), 0.0, 0);
   return true;
 }
+
+static std::atomic_bool isImmediateTasksCallbackScheduled(false);
+
+// Only one `later` callback is pending at a time. The first callback drains the whole queue anyway,
+// so the callbacks scheduled for the rest of a burst of immediate tasks would find it empty
+void scheduleImmediateTasksWithLater() {
+  if (isImmediateTasksCallbackScheduled.exchange(true)) return;
+  bool isScheduled = executeWithLater([] {
+    // The flag is cleared before the queue is polled, so a task pushed after that schedules a new callback
+    isImmediateTasksCallbackScheduled = false;
+    runImmediateTasks();
+  });
+  if (!isScheduled) isImmediateTasksCallbackScheduled = false;
+}
@@ -19,10 +19,13 @@
 
 #include <functional>
 #include <string>
+#include "util/Task.h"
 
 void initEventLoop();
 void quitEventLoop();
-void eventLoopExecute(std::function<void()> const& f, bool immediate = false);
+void eventLoopExecute(Task f, bool immediate = false);
+// Destroys the pending tasks without running them, must be called on the main thread
+void discardEventLoopTasks();
 void breakEventLoop(std::string s = "");
 std::string runEventLoop(bool disableOutput = true);
 bool isEventHandlerRunning();
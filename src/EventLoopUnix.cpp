@@ -20,21 +20,21 @@
 #include "RStuff/RInclude.h"
 #include "RStuff/RUtil.h"
 #include "debugger/RDebugger.h"
-#include "util/BlockingQueue.h"
+#include "util/MPSCQueue.h"
+#include <atomic>
 #include <unistd.h>
 
 static const int ACTIVITY = 27;
 static int eventLoopPipe[2];
-static std::mutex pipeMutex;
-static bool pipeFilled = false;
+static std::atomic_bool pipeFilled(false);
 
-static BlockingQueue<std::function<void()>> queue;
-static BlockingQueue<std::function<void()>> immediateQueue;
+static MPSCQueue<Task> queue;
+static MPSCQueue<Task> immediateQueue;
 static bool doBreakEventLoop = false;
 static std::string breakEventLoopValue;
 static volatile bool _isEventHandlerRunning = false;
 
-bool executeWithLater(std::function<void()> const& f);
+void scheduleImmediateTasksWithLater();
 
 void initEventLoop() {
   if (pipe(eventLoopPipe)) {
@@ -43,13 +43,9 @@ void initEventLoop() {
   }
   addInputHandler(R_InputHandlers, eventLoopPipe[0], [](void*) {
     CPP_BEGIN
-      {
-      std::unique_lock<std::mutex> lock(pipeMutex);
-      if (pipeFilled) {
-        char c;
-        read(eventLoopPipe[0], &c, 1);
-        pipeFilled = false;
-      }
+    if (pipeFilled.exchange(false)) {
+      char c;
+      read(eventLoopPipe[0], &c, 1);
     }
     runImmediateTasks();
     CPP_END_VOID_NOINTR
@@ -61,18 +57,23 @@ void quitEventLoop() {
   close(eventLoopPipe[1]);
 }
 
-void eventLoopExecute(std::function<void()> const& f, bool immediate) {
-  std::unique_lock<std::mutex> lock(pipeMutex);
+void eventLoopExecute(Task f, bool immediate) {
   if (immediate) {
-    immediateQueue.push(f);
-    executeWithLater(runImmediateTasks);
+    immediateQueue.push(std::move(f));
+    scheduleImmediateTasksWithLater();
   } else {
-    queue.push(f);
+    queue.push(std::move(f));
   }
-  if (pipeFilled) return;
+  // The flag is cleared by the handler before it reads the pipe, so a task pushed after that always writes a byte
+  if (pipeFilled.exchange(true)) return;
   char c = '\0';
   write(eventLoopPipe[1], &c, 1);
-  pipeFilled = true;
+}
+
+void discardEventLoopTasks() {
+  Task f;
+  while (immediateQueue.poll(f)) f.reset();
+  while (queue.poll(f)) f.reset();
 }
 
 void breakEventLoop(std::string s) {
@@ -82,7 +83,7 @@ void breakEventLoop(std::string s) {
 
 std::string runEventLoop(bool disableOutput) {
   while (true) {
-    std::function<void()> f;
+    Task f;
     if (queue.poll(f)) {
       WithOutputHandler withOutputHandler = disableOutput ? WithOutputHandler(emptyOutputHandler)
                                                           : WithOutputHandler();
@@ -110,7 +111,7 @@ bool isEventHandlerRunning() {
 }
 
 void runImmediateTasks() {
-  std::function<void()> f;
+  Task f;
   if (immediateQueue.poll(f)) {
     WithOutputHandler withOutputHandler(emptyOutputHandler);
     WithDebuggerEnabled withDebugger(false);
@@ -15,7 +15,7 @@
 //  along with this program.  If not, see <https://www.gnu.org/licenses/>.
 
 #include "EventLoop.h"
-#include "util/BlockingQueue.h"
+#include "util/MPSCQueue.h"
 #include "IO.h"
 #include "debugger/RDebugger.h"
 #include <windows.h>
@@ -23,13 +23,13 @@
 #include "RStuff/Export.h"
 
 static HWND dummyWindow;
-static BlockingQueue<std::function<void()>> queue;
-static BlockingQueue<std::function<void()>> immediateQueue;
+static MPSCQueue<Task> queue;
+static MPSCQueue<Task> immediateQueue;
 static bool doBreakEventLoop = false;
 static std::string breakEventLoopValue;
 static volatile bool _isEventHandlerRunning = false;
 
-bool executeWithLater(std::function<void()> const& f);
+void scheduleImmediateTasksWithLater();
 
 static LRESULT CALLBACK dummyWndProc(HWND hwnd, UINT uMsg, WPARAM wParam, LPARAM lParam) {
   CPP_BEGIN
@@ -59,16 +59,22 @@ void quitEventLoop() {
   DestroyWindow(dummyWindow);
 }
 
-void eventLoopExecute(std::function<void()> const& f, bool immediate) {
+void eventLoopExecute(Task f, bool immediate) {
   if (immediate) {
-    immediateQueue.push(f);
-    executeWithLater(runImmediateTasks);
+    immediateQueue.push(std::move(f));
+    scheduleImmediateTasksWithLater();
   } else {
-    queue.push(f);
+    queue.push(std::move(f));
   }
   PostMessage(dummyWindow, WM_USER, 0, 0);
 }
 
+void discardEventLoopTasks() {
+  Task f;
+  while (immediateQueue.poll(f)) f.reset();
+  while (queue.poll(f)) f.reset();
+}
+
 void breakEventLoop(std::string s) {
   breakEventLoopValue = std::move(s);
   doBreakEventLoop = true;
@@ -76,7 +82,7 @@ void breakEventLoop(std::string s) {
 
 std::string runEventLoop(bool disableOutput) {
   while (true) {
-    std::function<void()> f;
+    Task f;
     if (queue.poll(f)) {
       WithOutputHandler withOutputHandler = disableOutput ? WithOutputHandler(emptyOutputHandler)
                                                           : WithOutputHandler();
@@ -104,7 +110,7 @@ bool isEventHandlerRunning() {
 }
 
 void runImmediateTasks() {
-  std::function<void()> f;
+  Task f;
   if (immediateQueue.poll(f)) {
     WithOutputHandler withOutputHandler(emptyOutputHandler);
     WithDebuggerEnabled withDebugger(false);
@@ -18,6 +18,7 @@
 #include "IO.h"
 #include "RPIServiceImpl.h"
 #include "RStuff/RUtil.h"
+#include <R_ext/Parse.h>
 #include "debugger/SourceFileManager.h"
 #include "util/ScopedAssign.h"
 #include <grpcpp/server_builder.h>
@@ -27,6 +28,14 @@
 static void executeCodeImpl(SEXP exprs, SEXP env, bool withEcho = true, bool isDebug = false,
                             bool withExceptionHandler = false, bool setLasValue = false,
                             bool callToplevelHandlers = false);
+static void executeCodeByChunks(std::string const& code, SEXP env, bool withEcho, bool isRepl, bool setLastValue,
+                                bool keepSource, std::string sourceFileId, int sourceFileLineOffset,
+                                int sourceFileFirstLineOffset);
+
+// Larger scripts are parsed and executed by chunks of complete top level statements,
+// so the first statement runs before the rest is parsed
+static const size_t EXECUTE_BY_CHUNKS_MIN_SIZE = 4 << 20;
+static const int EXECUTE_CHUNK_LINES = 512;
 
 static void exceptionToProto(SEXP _e, ExceptionInfo *proto) {
   ShieldSEXP e = _e;
@@ -90,7 +99,7 @@ Status RPIServiceImpl::executeCode(ServerContext* context, const ExecuteCodeRequ
           event.mutable_prompt();
           rDebugger.clearSavedStack();
         }
-        asyncEvents.push(event);
+        pushAsyncEvent(std::move(event));
       }
     }};
 
@@ -101,7 +110,7 @@ Status RPIServiceImpl::executeCode(ServerContext* context, const ExecuteCodeRequ
       if (isRepl) {
         AsyncEvent event;
         event.mutable_busy();
-        asyncEvents.push(event);
+        pushAsyncEvent(std::move(event));
         rDebugger.resetLastErrorStack();
         if (isDebug) {
           if (firstDebugCommand == ExecuteCodeRequest_DebugCommand_CONTINUE) {
@@ -111,13 +120,19 @@ Status RPIServiceImpl::executeCode(ServerContext* context, const ExecuteCodeRequ
           }
         }
       }
-      PrSEXP expressions;
-      expressions = parseCode(code, isRepl || asBool(RI->getOption("keep.source")));
-      if (isRepl) {
-        sourceFileManager.registerSrcfile(Rf_getAttrib(expressions, RI->srcfileAttr), sourceFileId,
-                                          sourceFileLineOffset, sourceFileFirstLineOffset);
+      bool keepSource = isRepl || asBool(RI->getOption("keep.source"));
+      if (!isDebug && code.size() >= EXECUTE_BY_CHUNKS_MIN_SIZE) {
+        executeCodeByChunks(code, currentEnvironment(), withEcho, isRepl, setLastValue,
+                            keepSource, sourceFileId, sourceFileLineOffset, sourceFileFirstLineOffset);
+      } else {
+        PrSEXP expressions;
+        expressions = parseCode(code, keepSource);
+        if (isRepl) {
+          sourceFileManager.registerSrcfile(Rf_getAttrib(expressions, RI->srcfileAttr), sourceFileId,
+                                            sourceFileLineOffset, sourceFileFirstLineOffset);
+        }
+        executeCodeImpl(expressions, currentEnvironment(), withEcho, isDebug, isRepl, setLastValue, isRepl);
       }
-      executeCodeImpl(expressions, currentEnvironment(), withEcho, isDebug, isRepl, setLastValue, isRepl);
     } catch (RError const& e) {
       if (writer != nullptr) {
         ExecuteCodeResponse response;
@@ -158,23 +173,26 @@ std::string RPIServiceImpl::readLineHandler(std::string const& prompt) {
   if (replState != REPL_BUSY) return "";
   AsyncEvent event;
   event.mutable_requestreadln()->set_prompt(prompt);
-  asyncEvents.push(event);
+  pushAsyncEvent(std::move(event));
   ScopedAssign<ReplState> withState(replState, READ_LINE);
   std::string result = runEventLoop();
-  event.mutable_busy();
-  asyncEvents.push(event);
+  AsyncEvent busyEvent;
+  busyEvent.mutable_busy();
+  pushAsyncEvent(std::move(busyEvent));
   return result;
 }
 
 void RPIServiceImpl::debugPromptHandler() {
   if (replState != REPL_BUSY) return;
+  invalidateDereferenceCache();
   AsyncEvent event;
   rDebugger.buildDebugPrompt(event.mutable_debugprompt());
-  asyncEvents.push(event);
+  pushAsyncEvent(std::move(event));
   ScopedAssign<ReplState> withState(replState, DEBUG_PROMPT);
   runEventLoop();
-  event.mutable_busy();
-  asyncEvents.push(event);
+  AsyncEvent busyEvent;
+  busyEvent.mutable_busy();
+  pushAsyncEvent(std::move(busyEvent));
 }
 
 Status RPIServiceImpl::executeCommand(ServerContext* context, const std::string& command, ServerWriter<CommandOutput>* writer) {
@@ -270,7 +288,7 @@ static void executeCodeImpl(SEXP _exprs, SEXP _env, bool withEcho, bool isDebug,
   ShieldSEXP srcrefs = getBlockSrcrefs(exprs);
   ScopedAssign<RContext*> with1(rDebugger.bottomContext, nullptr);
   ScopedAssign<SEXP> with2(rDebugger.bottomContextRealEnv, env);
-  ScopedAssign<std::string> with(currentExpr, "");
+  ScopedAssign<SEXP> with(currentExpr, R_NilValue);
   auto func = [&] {
     SourceFileManager::preprocessSrcrefs(exprs);
     RContext *currentCallContext = getCurrentCallContext();
@@ -280,7 +298,7 @@ static void executeCodeImpl(SEXP _exprs, SEXP _env, bool withEcho, bool isDebug,
     }
     for (int i = 0; i < length; ++i) {
       SEXP expr = exprs[i];
-      currentExpr = stringEltUTF8(RI->deparse.invokeUnsafeInEnv(R_BaseEnv, RI->quote.lang(expr)), 0);
+      currentExpr = expr;
       PROTECT(R_Srcref = getSrcref(srcrefs, i));
       SEXP value;
       bool visible = false;
@@ -325,3 +343,139 @@ static void executeCodeImpl(SEXP _exprs, SEXP _env, bool withEcho, bool isDebug,
   }
   safeEval(call, newEnv, true);
 }
+
+static size_t skipLines(std::string const& code, size_t pos, int count) {
+  while (count-- > 0 && pos < code.size()) {
+    pos = code.find('\n', pos);
+    if (pos == std::string::npos) return code.size();
+    ++pos;
+  }
+  return pos;
+}
+
+struct ParseVectorData {
+  SEXP text;
+  int n;
+  SEXP srcfile;
+  ParseStatus status;
+  SEXP result;
+};
+
+// Parses at most `n` statements (all if `n` is negative)
+static SEXP tryParseVector(SEXP text, int n, SEXP srcfile, ParseStatus& status) {
+  ParseVectorData data = {text, n, srcfile, PARSE_ERROR, R_NilValue};
+  bool success = R_ToplevelExec([](void* p) {
+    auto data = (ParseVectorData*)p;
+    data->result = R_ParseVector(data->text, data->n, &data->status, data->srcfile);
+  }, &data);
+  status = success ? data.status : PARSE_ERROR;
+  return success ? data.result : R_NilValue;
+}
+
+// Size of the prefix of the chunk which consists of complete statements, when the chunk ends inside a statement.
+// Parsing of the first `n` statements succeeds iff they are complete, so their number is found by binary search
+// and their end is taken from the srcref of the last one
+static size_t getCompleteStatementsSize(std::string const& chunk, SEXP text) {
+  int low = 0;
+  int high = 1 + (int)std::count_if(chunk.begin(), chunk.end(), [](char c) { return c == '\n' || c == ';'; });
+  while (low < high) {
+    int middle = low + (high - low + 1) / 2;
+    ParseStatus status;
+    tryParseVector(text, middle, R_NilValue, status);
+    if (status == PARSE_OK) {
+      low = middle;
+    } else {
+      high = middle - 1;
+    }
+  }
+  if (low == 0) return 0;
+  ShieldSEXP srcfile = RI->srcfilecopy("<text>", text);
+  ParseStatus status;
+  ShieldSEXP exprs = tryParseVector(text, low, srcfile, status);
+  ShieldSEXP srcrefs = Rf_getAttrib(exprs, RI->srcrefAttr);
+  if (status != PARSE_OK || srcrefs.type() != VECSXP || srcrefs.length() < low) return 0;
+  SEXP srcref = VECTOR_ELT(srcrefs, low - 1);
+  if (TYPEOF(srcref) != INTSXP || Rf_xlength(srcref) < 4) return 0;
+  int lastLine = INTEGER(srcref)[2];
+  int lastByte = INTEGER(srcref)[3];
+  return std::min(skipLines(chunk, 0, lastLine - 1) + lastByte, chunk.size());
+}
+
+// Number of characters in the line before `pos`
+static int getColumn(std::string const& code, size_t pos) {
+  size_t lineStart = pos == 0 ? std::string::npos : code.rfind('\n', pos - 1);
+  lineStart = lineStart == std::string::npos ? 0 : lineStart + 1;
+  // Continuation bytes of UTF-8 are not counted
+  return (int)std::count_if(code.begin() + lineStart, code.begin() + pos, [](char c) { return (c & 0xC0) != 0x80; });
+}
+
+// Statements of the chunks before a syntax error are executed, the chunk with the error is rejected as a whole.
+// A chunk which ends inside a statement is cut after the last complete one, so the next chunk may start in the middle of a line
+static void executeCodeByChunks(std::string const& code, SEXP env, bool withEcho, bool isRepl, bool setLastValue,
+                                bool keepSource, std::string sourceFileId, int sourceFileLineOffset,
+                                int sourceFileFirstLineOffset) {
+  // The text of the virtual file, the lines are filled in as the chunks are executed
+  PrSEXP lines;
+  int filledLines = 0;
+  size_t filledSize = 0;
+  if (isRepl) {
+    size_t lineCount = std::count(code.begin(), code.end(), '\n') + (code.back() == '\n' ? 0 : 1);
+    lines = Rf_allocVector(STRSXP, lineCount);
+  }
+  size_t begin = 0;
+  int chunkLineOffset = 0;
+  int chunkLines = EXECUTE_CHUNK_LINES;
+  while (begin < code.size()) {
+    size_t end = skipLines(code, begin, chunkLines);
+    std::string chunk = code.substr(begin, end - begin);
+    ShieldSEXP text = mkStringUTF8(chunk.c_str());
+    ShieldSEXP srcfile = keepSource ? RI->srcfilecopy("<text>", text) : R_NilValue;
+    ParseStatus status;
+    ShieldSEXP exprs = tryParseVector(text, -1, srcfile, status);
+#ifdef Win32
+    // Gets the strings in the right encoding
+    bool reparse = true;
+#else
+    bool reparse = false;
+#endif
+    if (status == PARSE_INCOMPLETE && end < code.size()) {
+      size_t completeSize = getCompleteStatementsSize(chunk, text);
+      if (completeSize == 0) {
+        // The chunk starts with a statement which is longer than it, retry with more lines
+        chunkLines *= 2;
+        continue;
+      }
+      end = begin + completeSize;
+      chunk.resize(completeSize);
+      status = PARSE_OK;
+      reparse = true;
+    }
+    int column = getColumn(code, begin);
+    if (status != PARSE_OK) {
+      // Throws the usual parse error, the chunk is padded so that the error position is the one in the whole code
+      parseCode(std::string(chunkLineOffset, '\n') + std::string(column, ' ') + chunk, keepSource);
+      reparse = true;
+    }
+    PrSEXP parsed = reparse ? parseCode(chunk, keepSource) : (SEXP)exprs;
+    if (isRepl) {
+      for (; filledSize < end && filledLines < Rf_xlength(lines); ++filledLines) {
+        size_t lineEnd = std::min(code.find('\n', filledSize), code.size());
+        if (lineEnd >= end && end < code.size()) break;
+        SET_STRING_ELT(lines, filledLines, Rf_mkCharLenCE(code.data() + filledSize, lineEnd - filledSize, CE_UTF8));
+        filledSize = lineEnd + 1;
+      }
+      // All chunks share one virtual file, the srcrefs of a chunk are shifted by its position
+      VirtualFileInfoPtr virtualFile = sourceFileManager.registerSrcfile(
+          Rf_getAttrib(parsed, RI->srcfileAttr), sourceFileId, sourceFileLineOffset + chunkLineOffset,
+          column + (chunkLineOffset == 0 ? sourceFileFirstLineOffset : 0));
+      if (!virtualFile.isNull()) {
+        sourceFileId = virtualFile->id;
+        virtualFile->lines = lines;
+      }
+    }
+    executeCodeImpl(parsed, env, withEcho, false, isRepl, setLastValue, isRepl);
+    chunkLineOffset += std::count(code.begin() + begin, code.begin() + end, '\n');
+    begin = end;
+    chunkLines = EXECUTE_CHUNK_LINES;
+  }
+}
@@ -25,7 +25,12 @@ void CommandLineOptions::parse(int argc, char* argv[]) {
       ("with-timeout", "Terminate RWrapper if no RPCs were received for a minute")
       ("crash-report-file", "File for saving crash report", cxxopts::value<std::string>())
       ("is-remote", "RWrapper is run on a remote host")
-      ("disable-rprofile", "Don't run .Rprofile on startup");
+      ("disable-rprofile", "Don't run .Rprofile on startup")
+      ("single-replay-plots", "Extrapolate plots from a single replay instead of two")
+      ("data-frame-cache-budget", "Memory (in MB) for tables kept by data viewers before the least recently used are released",
+       cxxopts::value<int>())
+      ("output-stall-timeout", "Time (in ms) R may wait for the IDE to take console output before the rest of the flood is written to a file, 0 to always wait",
+       cxxopts::value<int>());
   try {
     auto result = options.parse(argc, argv);
     if (result["help"].as<bool>()) {
@@ -35,6 +40,13 @@ void CommandLineOptions::parse(int argc, char* argv[]) {
     withTimeout = result["with-timeout"].as<bool>();
     isRemote = result["is-remote"].as<bool>();
     disableRprofile = result["disable-rprofile"].as<bool>();
+    singleReplayPlots = result["single-replay-plots"].as<bool>();
+    if (result.count("data-frame-cache-budget")) {
+      dataFrameCacheBudgetMb = result["data-frame-cache-budget"].as<int>();
+    }
+    if (result.count("output-stall-timeout")) {
+      outputStallTimeoutMs = result["output-stall-timeout"].as<int>();
+    }
     if (result.count("crash-report-file")) {
       crashReportFile = result["crash-report-file"].as<std::string>();
     }
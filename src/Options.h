@@ -24,6 +24,9 @@ struct CommandLineOptions {
   std::string crashReportFile;
   bool isRemote = false;
   bool disableRprofile = false;
+  bool singleReplayPlots = false;
+  int dataFrameCacheBudgetMb = 2048;
+  int outputStallTimeoutMs = 1000;
 
   void parse(int argc, char* argv[]);
 };
@@ -15,15 +15,31 @@
 //  along with this program.  If not, see <https://www.gnu.org/licenses/>.
 
 #include "RPIServiceImpl.h"
+#include "RStuff/FormatReal.h"
+#include "RStuff/ObjectSizeEstimator.h"
 #include "RStuff/RUtil.h"
 #include "util/ContainerUtil.h"
 #include "util/StringUtil.h"
 #include <grpcpp/server_builder.h>
+#include <cstdint>
+#include <chrono>
+#include <climits>
+#include <cmath>
+#include <cstring>
+#include <functional>
 #include <limits>
+#include <list>
+#include <memory>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
 
 static const int MAX_PREVIEW_STRING_LENGTH = 400;
 static const int MAX_PREVIEW_CLS_LENGTH = 200;
 static const int MAX_PREVIEW_PRINTED_COUNT = 20;
+static const int OBJECT_SIZE_TIME_SLICE_MS = 20;
+static const int OBJECT_SIZE_TIME_BUDGET_MS = 5000;
+static const char* const OBJECT_SIZE_PARTIAL_METADATA_KEY = "rwr-partial-object-sizes";
 
 static bool trim(std::string &s, int len = MAX_PREVIEW_STRING_LENGTH) {
   if (s.length() <= len) return true;
@@ -32,6 +48,192 @@ static bool trim(std::string &s, int len = MAX_PREVIEW_STRING_LENGTH) {
   return false;
 }
 
+// Native counterparts of `print` for the plain vectors shown in previews.
+// They produce exactly what `print` would produce with `width = DEFAULT_WIDTH`
+// and return false for the values which they can't handle (then the caller falls back to `print`).
+// Doubles are formatted by the port of R's `formatReal` in FormatReal.h
+
+static const int PRINT_GAP = 1;
+
+static int getIntOption(const char* name, int defaultValue) {
+  int value = Rf_asInteger(Rf_GetOption1(Rf_install(name)));
+  return value == NA_INTEGER ? defaultValue : value;
+}
+
+static std::string layoutPrintedVector(std::vector<std::string> const& cells, bool alignLeft) {
+  size_t width = 0;
+  for (auto const& cell : cells) width = std::max(width, cell.size());
+  int labelWidth = (int)std::to_string(cells.size()).size() + 2;
+  std::string result;
+  auto appendLabel = [&](size_t index) {
+    std::string label = "[" + std::to_string(index) + "]";
+    result.append(labelWidth - label.size(), ' ');
+    result += label;
+  };
+  appendLabel(1);
+  size_t lineWidth = labelWidth;
+  for (size_t i = 0; i < cells.size(); ++i) {
+    if (i > 0 && lineWidth + width + PRINT_GAP > DEFAULT_WIDTH) {
+      result += '\n';
+      appendLabel(i + 1);
+      lineWidth = labelWidth;
+    }
+    result.append(PRINT_GAP, ' ');
+    if (!alignLeft) result.append(width - cells[i].size(), ' ');
+    result += cells[i];
+    if (alignLeft) result.append(width - cells[i].size(), ' ');
+    lineWidth += width + PRINT_GAP;
+  }
+  result += '\n';
+  return result;
+}
+
+static bool isPrintableAscii(const char* s) {
+  for (; *s; ++s) {
+    if (*s < 0x20 || *s > 0x7e) return false;
+  }
+  return true;
+}
+
+static bool formatStringCell(SEXP s, bool quote, std::string& cell) {
+  if (s == NA_STRING) {
+    cell = quote ? "NA" : "<NA>";
+    return true;
+  }
+  const char* chars = CHAR(s);
+  if (!isPrintableAscii(chars)) return false;
+  cell.clear();
+  if (quote) cell += '"';
+  for (; *chars; ++chars) {
+    if (*chars == '\\' || (quote && *chars == '"')) cell += '\\';
+    cell += *chars;
+  }
+  if (quote) cell += '"';
+  return true;
+}
+
+static bool hasAttributesOtherThanClass(SEXP x) {
+  for (SEXP a = ATTRIB(x); a != R_NilValue; a = CDR(a)) {
+    if (TAG(a) != R_ClassSymbol) return true;
+  }
+  return false;
+}
+
+static void trimPrintedValue(std::string& s, bool& trimmed) {
+  trimmed = s.size() > MAX_PREVIEW_STRING_LENGTH;
+  if (trimmed) s.erase(s.begin() + MAX_PREVIEW_STRING_LENGTH, s.end());
+}
+
+// Same as `print(unclass(x)[1:MAX_PREVIEW_PRINTED_COUNT])` or `printFactorSimple` for factors
+static bool formatVectorPreview(SEXP x, std::string& result, bool& trimmed) {
+  R_xlen_t length = std::min<R_xlen_t>(Rf_xlength(x), MAX_PREVIEW_PRINTED_COUNT);
+  std::vector<std::string> cells;
+  if (Rf_inherits(x, "factor")) {
+    if (TYPEOF(x) != INTSXP) return false;
+    if (length == 0) {
+      result = Rf_inherits(x, "ordered") ? "ordered(0)\n" : "factor(0)\n";
+      return true;
+    }
+    SEXP levels = Rf_getAttrib(x, R_LevelsSymbol);
+    if (TYPEOF(levels) != STRSXP) return false;
+    for (R_xlen_t i = 0; i < length; ++i) {
+      int code = INTEGER_ELT(x, i);
+      SEXP level = code == NA_INTEGER || code < 1 || code > Rf_xlength(levels) ? NA_STRING : STRING_ELT(levels, code - 1);
+      std::string cell;
+      if (!formatStringCell(level, false, cell)) return false;
+      cells.push_back(std::move(cell));
+    }
+    result = layoutPrintedVector(cells, true);
+    trimPrintedValue(result, trimmed);
+    return true;
+  }
+  if (Rf_getAttrib(x, R_NamesSymbol) != R_NilValue) return false;
+  if (Rf_xlength(x) <= MAX_PREVIEW_PRINTED_COUNT && hasAttributesOtherThanClass(x)) return false;
+  switch (TYPEOF(x)) {
+    case NILSXP:
+      result = "NULL\n";
+      return true;
+    case LGLSXP:
+      if (length == 0) {
+        result = "logical(0)\n";
+        return true;
+      }
+      for (R_xlen_t i = 0; i < length; ++i) {
+        int value = LOGICAL_ELT(x, i);
+        cells.emplace_back(value == NA_LOGICAL ? "NA" : value ? "TRUE" : "FALSE");
+      }
+      break;
+    case INTSXP:
+      if (length == 0) {
+        result = "integer(0)\n";
+        return true;
+      }
+      for (R_xlen_t i = 0; i < length; ++i) {
+        int value = INTEGER_ELT(x, i);
+        cells.emplace_back(value == NA_INTEGER ? "NA" : std::to_string(value));
+      }
+      break;
+    case REALSXP: {
+      if (length == 0) {
+        result = "numeric(0)\n";
+        return true;
+      }
+      int digits = std::min(std::max(getIntOption("digits", 7), 1), 22);
+      cells = formatRealCells(x, length, digits, getIntOption("scipen", 0));
+      break;
+    }
+    default:
+      return false;
+  }
+  result = layoutPrintedVector(cells, false);
+  trimPrintedValue(result, trimmed);
+  return true;
+}
+
+// Same as printing `substring(x[1:MAX_PREVIEW_PRINTED_COUNT], 1, MAX_PREVIEW_STRING_LENGTH)`
+static bool formatStringPreview(SEXP x, std::string& result, bool& trimmed, bool& isComplete) {
+  // Names and other attributes are kept by `substring`, so such values are printed by R
+  if (hasAttributesOtherThanClass(x)) return false;
+  R_xlen_t length = std::min<R_xlen_t>(Rf_xlength(x), MAX_PREVIEW_PRINTED_COUNT);
+  if (length == 0) {
+    result = "character(0)\n";
+    trimmed = false;
+    return true;
+  }
+  std::vector<std::string> cells;
+  for (R_xlen_t i = 0; i < length; ++i) {
+    SEXP s = STRING_ELT(x, i);
+    std::string cell;
+    if (s != NA_STRING && strlen(CHAR(s)) >= MAX_PREVIEW_STRING_LENGTH) {
+      if (!isPrintableAscii(CHAR(s))) return false;
+      isComplete = false;
+      s = Rf_mkCharLen(CHAR(s), MAX_PREVIEW_STRING_LENGTH);
+    }
+    if (!formatStringCell(s, true, cell)) return false;
+    cells.push_back(std::move(cell));
+  }
+  result = layoutPrintedVector(cells, true);
+  trimPrintedValue(result, trimmed);
+  return true;
+}
+
+// Same as `nrow(x)` and `ncol(x)` for data frames without the need to expand compact row names
+static bool getDataFrameDimensions(SEXP x, int& rows, int& cols) {
+  if (TYPEOF(x) != VECSXP) return false;
+  for (SEXP a = ATTRIB(x); a != R_NilValue; a = CDR(a)) {
+    if (TAG(a) != R_RowNamesSymbol) continue;
+    SEXP rowNames = CAR(a);
+    if (TYPEOF(rowNames) == INTSXP && Rf_xlength(rowNames) == 2 && INTEGER_ELT(rowNames, 0) == NA_INTEGER) {
+      rows = std::abs(INTEGER_ELT(rowNames, 1));
+    } else {
+      rows = (int)Rf_xlength(rowNames);
+    }
+    cols = (int)Rf_xlength(x);
+    return true;
+  }
+  return false;
+}
+
 void getValueInfo(SEXP _var, ValueInfo* result) {
   ShieldSEXP var = _var;
   try {
@@ -96,8 +298,14 @@ void getValueInfo(SEXP _var, ValueInfo* result) {
       result->mutable_graph();
     } else if (Rf_inherits(var, "data.frame")) {
       ValueInfo::DataFrame* dataFrame = result->mutable_dataframe();
-      dataFrame->set_rows(asInt(RI->nrow(var)));
-      dataFrame->set_cols(asInt(RI->ncol(var)));
+      int rows, cols;
+      if (getDataFrameDimensions(var, rows, cols)) {
+        dataFrame->set_rows(rows);
+        dataFrame->set_cols(cols);
+      } else {
+        dataFrame->set_rows(asInt(RI->nrow(var)));
+        dataFrame->set_cols(asInt(RI->ncol(var)));
+      }
     } else if (type == S4SXP) {
       result->mutable_value()->set_iss4(true);
     } else {
@@ -119,20 +327,21 @@ void getValueInfo(SEXP _var, ValueInfo* result) {
             type == CPLXSXP || type == NILSXP) {
           R_xlen_t length = var.length();
           value->set_isvector(length > 1);
-          PrSEXP x = Rf_inherits(var, "factor") ? (SEXP)var : RI->unclass(var);
-          bool isComplete = true;
-          if (length > MAX_PREVIEW_PRINTED_COUNT) {
-            isComplete = false;
-            x = RI->subscript(x, RI->colon(1, MAX_PREVIEW_PRINTED_COUNT));
-          }
+          bool isComplete = length <= MAX_PREVIEW_PRINTED_COUNT;
           bool trimmed;
           std::string s;
-          if (Rf_inherits(x, "factor")) {
-            s = evalAndGetPrintedValueWithLimit(
-                RI->printFactorSimple.lang(x),
-                MAX_PREVIEW_STRING_LENGTH, trimmed);
-          } else {
-            s = getPrintedValueWithLimit(x, MAX_PREVIEW_STRING_LENGTH, trimmed);
+          if (!formatVectorPreview(var, s, trimmed)) {
+            PrSEXP x = Rf_inherits(var, "factor") ? (SEXP)var : RI->unclass(var);
+            if (length > MAX_PREVIEW_PRINTED_COUNT) {
+              x = RI->subscript(x, RI->colon(1, MAX_PREVIEW_PRINTED_COUNT));
+            }
+            if (Rf_inherits(x, "factor")) {
+              s = evalAndGetPrintedValueWithLimit(
+                  RI->printFactorSimple.lang(x),
+                  MAX_PREVIEW_STRING_LENGTH, trimmed);
+            } else {
+              s = getPrintedValueWithLimit(x, MAX_PREVIEW_STRING_LENGTH, trimmed);
+            }
           }
           value->set_textvalue(s);
           value->set_iscomplete(isComplete && !trimmed);
@@ -140,6 +349,13 @@ void getValueInfo(SEXP _var, ValueInfo* result) {
           int length = var.length();
           value->set_isvector(length > 1);
           bool isComplete = length <= MAX_PREVIEW_PRINTED_COUNT;
+          bool trimmed;
+          std::string s;
+          if (formatStringPreview(var, s, trimmed, isComplete)) {
+            value->set_textvalue(s);
+            value->set_iscomplete(isComplete && !trimmed);
+            return;
+          }
           ShieldSEXP unclassed = RI->unclass(var);
           ShieldSEXP vector =
               isComplete
@@ -154,7 +370,6 @@ void getValueInfo(SEXP _var, ValueInfo* result) {
               isComplete = false;
             }
           }
-          bool trimmed;
           value->set_textvalue(getPrintedValueWithLimit(vectorPrefix, MAX_PREVIEW_STRING_LENGTH, trimmed));
           value->set_iscomplete(isComplete && !trimmed);
         } else {
@@ -175,8 +390,163 @@ void getValueInfo(SEXP _var, ValueInfo* result) {
   }
 }
 
-Status RPIServiceImpl::loaderGetParentEnvs(ServerContext* context, const RRef* request, ParentEnvsResponse* response) {
-  executeOnMainThread([&] {
+// Identity of a variable's value together with everything `getValueInfo` looks at.
+// The values are not preserved (this would make them shared and force a copy on the next modification),
+// so the content which is shown in a preview is hashed as well in order to detect in-place modifications
+// and reuse of a freed object's address. The `digits` and `scipen` options change how numbers are printed
+struct ValueFingerprint {
+  SEXP value;
+  int type;
+  int named;
+  R_xlen_t length;
+  size_t attributesHash;
+  size_t contentHash;
+  int digits;
+  int scipen;
+
+  bool operator == (ValueFingerprint const& other) const {
+    return value == other.value && type == other.type && named == other.named && length == other.length &&
+           attributesHash == other.attributesHash && contentHash == other.contentHash &&
+           digits == other.digits && scipen == other.scipen;
+  }
+};
+
+static void combineHash(size_t& hash, size_t value) {
+  hash ^= value + 0x9e3779b9 + (hash << 6) + (hash >> 2);
+}
+
+static size_t hashPreviewContent(SEXP x) {
+  size_t hash = 0;
+  auto combine = [&](size_t value) { combineHash(hash, value); };
+  R_xlen_t length = std::min<R_xlen_t>(Rf_xlength(x), MAX_PREVIEW_PRINTED_COUNT);
+  for (R_xlen_t i = 0; i < length; ++i) {
+    switch (TYPEOF(x)) {
+      case LGLSXP: combine(std::hash<int>()(LOGICAL_ELT(x, i))); break;
+      case INTSXP: combine(std::hash<int>()(INTEGER_ELT(x, i))); break;
+      case REALSXP: {
+        double value = REAL_ELT(x, i);
+        uint64_t bits;
+        memcpy(&bits, &value, sizeof(bits));
+        combine(std::hash<uint64_t>()(bits));
+        break;
+      }
+      case CPLXSXP: {
+        Rcomplex value = COMPLEX(x)[i];
+        uint64_t bits[2];
+        memcpy(bits, &value, sizeof(bits));
+        combine(std::hash<uint64_t>()(bits[0]));
+        combine(std::hash<uint64_t>()(bits[1]));
+        break;
+      }
+      case STRSXP: combine(std::hash<SEXP>()(STRING_ELT(x, i))); break;
+      case VECSXP: case EXPRSXP: combine(std::hash<SEXP>()(VECTOR_ELT(x, i))); break;
+      default: return hash;
+    }
+  }
+  return hash;
+}
+
+// `names<-`, `levels<-`, `dim<-` etc. may replace an attribute value in place, so the whole ATTRIB list is hashed
+static size_t hashAttributes(SEXP x) {
+  size_t hash = 0;
+  for (SEXP attr = ATTRIB(x); attr != R_NilValue; attr = CDR(attr)) {
+    SEXP value = CAR(attr);
+    combineHash(hash, std::hash<SEXP>()(TAG(attr)));
+    combineHash(hash, std::hash<SEXP>()(value));
+    if (Rf_isVector(value)) {
+      combineHash(hash, std::hash<R_xlen_t>()(Rf_xlength(value)));
+      combineHash(hash, hashPreviewContent(value));
+    }
+  }
+  return hash;
+}
+
+// Returns false for values whose preview may change without any visible change of the value itself
+static bool getValueFingerprint(SEXP x, ValueFingerprint& fingerprint) {
+  switch (TYPEOF(x)) {
+    case PROMSXP:
+      return PRVALUE(x) != R_UnboundValue && getValueFingerprint(PRVALUE(x), fingerprint);
+    case ENVSXP:
+    case EXTPTRSXP:
+    case WEAKREFSXP:
+    case BCODESXP:
+      return false;
+    case CLOSXP:
+      fingerprint = ValueFingerprint{x, CLOSXP, NAMED(x), 0, hashAttributes(x), std::hash<SEXP>()(FORMALS(x)),
+                                     getIntOption("digits", 7), getIntOption("scipen", 0)};
+      return true;
+    default:
+      fingerprint = ValueFingerprint{x, TYPEOF(x), NAMED(x), Rf_xlength(x), hashAttributes(x), hashPreviewContent(x),
+                                     getIntOption("digits", 7), getIntOption("scipen", 0)};
+      return true;
+  }
+}
+
+struct VariableSnapshot {
+  ValueFingerprint fingerprint;
+  ValueInfo info;
+};
+
+struct EnvironmentSnapshot {
+  // Weak reference, so that another environment allocated at the same address doesn't get this snapshot
+  PrSEXP envRef;
+  std::unordered_map<std::string, VariableSnapshot> variables;
+};
+
+// The most recently viewed environments come first
+static const int MAX_ENVIRONMENT_SNAPSHOTS = 4;
+static std::list<EnvironmentSnapshot> environmentSnapshots;
+
+static EnvironmentSnapshot& getEnvironmentSnapshot(SEXP env) {
+  for (auto it = environmentSnapshots.begin(); it != environmentSnapshots.end(); ++it) {
+    if (R_WeakRefKey(it->envRef) == env) {
+      environmentSnapshots.splice(environmentSnapshots.begin(), environmentSnapshots, it);
+      return environmentSnapshots.front();
+    }
+  }
+  environmentSnapshots.push_front(EnvironmentSnapshot{R_MakeWeakRef(env, R_NilValue, R_NilValue, FALSE), {}});
+  if (environmentSnapshots.size() > MAX_ENVIRONMENT_SNAPSHOTS) {
+    environmentSnapshots.pop_back();
+  }
+  return environmentSnapshots.front();
+}
+
+static void getValueInfoWithSnapshot(EnvironmentSnapshot& snapshot, std::string const& name, SEXP x, ValueInfo* result) {
+  ValueFingerprint fingerprint;
+  if (!getValueFingerprint(x, fingerprint)) {
+    snapshot.variables.erase(name);
+    getValueInfo(x, result);
+    return;
+  }
+  auto it = snapshot.variables.find(name);
+  if (it != snapshot.variables.end() && it->second.fingerprint == fingerprint) {
+    result->CopyFrom(it->second.info);
+    return;
+  }
+  getValueInfo(x, result);
+  if (result->has_error()) {
+    snapshot.variables.erase(name);
+  } else {
+    snapshot.variables[name] = VariableSnapshot{fingerprint, *result};
+  }
+}
+
+static void removeStaleVariables(EnvironmentSnapshot& snapshot, SEXP ls) {
+  std::unordered_set<std::string> names;
+  for (R_xlen_t i = 0; i < Rf_xlength(ls); ++i) {
+    names.insert(stringEltNative(ls, i));
+  }
+  for (auto it = snapshot.variables.begin(); it != snapshot.variables.end();) {
+    if (names.count(it->first)) {
+      ++it;
+    } else {
+      it = snapshot.variables.erase(it);
+    }
+  }
+}
+
+ServerUnaryReactor* RPIServiceImpl::loaderGetParentEnvs(CallbackServerContext* context, const RRef* request, ParentEnvsResponse* response) {
+  return executeOnMainThreadAsync(context, [=] {
     PrSEXP environment = dereference(*request);
     if (environment.type() != ENVSXP) return;
     PrSEXP cycleDetector = environment;
@@ -190,12 +560,11 @@ Status RPIServiceImpl::loaderGetParentEnvs(ServerContext* context, const RRef* r
       envInfo->set_name(name);
       if (environment == cycleDetector) break;
     }
-  }, context, true);
-  return Status::OK;
+  });
 }
 
-Status RPIServiceImpl::loaderGetVariables(ServerContext* context, const GetVariablesRequest* request, VariablesResponse* response) {
-  executeOnMainThread([&] {
+ServerUnaryReactor* RPIServiceImpl::loaderGetVariables(CallbackServerContext* context, const GetVariablesRequest* request, VariablesResponse* response) {
+  return executeOnMainThreadAsync(context, [=] {
     ShieldSEXP obj = dereference(request->obj());
     R_xlen_t reqStart = request->start();
     R_xlen_t reqEnd = request->end();
@@ -205,6 +574,7 @@ Status RPIServiceImpl::loaderGetVariables(ServerContext* context, const GetVaria
       if (request->onlyfunctions() && request->nofunctions()) return;
       ShieldSEXP ls = RI->ls(named("envir", obj), named("all.names", !request->nohidden()));
       if (ls.type() != STRSXP) return;
+      EnvironmentSnapshot& snapshot = getEnvironmentSnapshot(obj);
       R_xlen_t length = ls.length();
       if (request->onlyfunctions() || request->nofunctions()) {
         R_xlen_t j = 0;
@@ -217,7 +587,7 @@ Status RPIServiceImpl::loaderGetVariables(ServerContext* context, const GetVaria
               std::string name = stringEltUTF8(ls, i);
               trim(name);
               var->set_name(name);
-              getValueInfo(x, var->mutable_value());
+              getValueInfoWithSnapshot(snapshot, stringEltNative(ls, i), x, var->mutable_value());
             }
             ++j;
           }
@@ -230,9 +600,10 @@ Status RPIServiceImpl::loaderGetVariables(ServerContext* context, const GetVaria
           std::string name = stringEltUTF8(ls, i);
           trim(name);
           var->set_name(name);
-          getValueInfo(obj.getVar(stringEltNative(ls, i), false), var->mutable_value());
+          getValueInfoWithSnapshot(snapshot, stringEltNative(ls, i), obj.getVar(stringEltNative(ls, i), false), var->mutable_value());
         }
       }
+      removeStaleVariables(snapshot, ls);
       return;
     }
     response->set_isenv(false);
@@ -271,12 +642,11 @@ Status RPIServiceImpl::loaderGetVariables(ServerContext* context, const GetVaria
       var->set_name(name);
       getValueInfo(RI->doubleSubscript(filtered, i + 1), var->mutable_value());
     }
-  }, context, true);
-  return Status::OK;
+  });
 }
 
-Status RPIServiceImpl::loaderGetLoadedNamespaces(ServerContext* context, const Empty*, StringList* response) {
-  executeOnMainThread([&] {
+ServerUnaryReactor* RPIServiceImpl::loaderGetLoadedNamespaces(CallbackServerContext* context, const Empty*, StringList* response) {
+  return executeOnMainThreadAsync(context, [=] {
     PrSEXP env = RI->globalEnv.parentEnv();
     while (env != R_EmptyEnv && env != R_NilValue) {
       std::string name = asStringUTF8(RI->environmentName(env));
@@ -286,12 +656,11 @@ Status RPIServiceImpl::loaderGetLoadedNamespaces(ServerContext* context, const E
       env = env.parentEnv();
     }
     response->add_list("base");
-  }, context, true);
-  return Status::OK;
+  });
 }
 
-Status RPIServiceImpl::loaderGetValueInfo(ServerContext* context, const RRef* request, ValueInfo* response) {
-  executeOnMainThread([&] {
+ServerUnaryReactor* RPIServiceImpl::loaderGetValueInfo(CallbackServerContext* context, const RRef* request, ValueInfo* response) {
+  return executeOnMainThreadAsync(context, [=] {
     try {
       getValueInfo(dereference(*request), response);
     } catch (RExceptionBase const& e) {
@@ -300,23 +669,56 @@ Status RPIServiceImpl::loaderGetValueInfo(ServerContext* context, const RRef* re
       response->mutable_error()->set_text("Error");
       throw;
     }
-  }, context, true);
-  return Status::OK;
+  });
 }
 
 Status RPIServiceImpl::getObjectSizes(ServerContext* context, const RRefList* request, Int64List* response) {
+  std::vector<std::unique_ptr<ObjectSizeEstimator>> estimators;
   executeOnMainThread([&] {
     for (RRef const& ref : request->refs()) {
-      long long size;
       try {
-        size = asInt64OrError(RI->objectSize(Rf_lang2(RI->quote, dereference(ref))));
+        estimators.push_back(std::make_unique<ObjectSizeEstimator>(dereference(ref)));
       } catch (RInterruptedException const&) {
         throw;
       } catch (RExceptionBase const&) {
-        size = -1;
+        estimators.push_back(nullptr);
       }
-      response->add_list(size);
     }
   }, context, true);
+
+  // Note: walk the objects in time slices so that the main thread can handle other requests in between
+  auto budgetDeadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(OBJECT_SIZE_TIME_BUDGET_MS);
+  bool isDone = false;
+  while (!isDone && !context->IsCancelled() && !terminateProceed && std::chrono::steady_clock::now() < budgetDeadline) {
+    executeOnMainThread([&] {
+      auto sliceDeadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(OBJECT_SIZE_TIME_SLICE_MS);
+      isDone = true;
+      for (auto const& estimator : estimators) {
+        if (estimator != nullptr && !estimator->advance(sliceDeadline)) {
+          isDone = false;
+          break;
+        }
+      }
+    }, context, true);
+  }
+
+  // Note: the sizes of the objects which haven't been walked through within the budget are lower bounds,
+  // their indices are sent in the trailing metadata since Int64List has no room for that
+  std::string partialSizes;
+  for (int i = 0; i < (int)estimators.size(); ++i) {
+    auto const& estimator = estimators[i];
+    response->add_list(estimator != nullptr ? estimator->getSize() : -1);
+    if (estimator != nullptr && !estimator->isDone()) {
+      if (!partialSizes.empty()) partialSizes += ',';
+      partialSizes += std::to_string(i);
+    }
+  }
+  if (!partialSizes.empty()) {
+    context->AddTrailingMetadata(OBJECT_SIZE_PARTIAL_METADATA_KEY, partialSizes);
+  }
+  // Note: preserved objects must be released on the main thread
+  executeOnMainThread([&] {
+    estimators.clear();
+  }, nullptr, true);
   return Status::OK;
 }
@@ -37,6 +37,8 @@
 #include "graphics/figures/TextFigure.h"
 #include "graphics/viewports/FixedViewport.h"
 #include "graphics/viewports/FreeViewport.h"
+#include <algorithm>
+#include <chrono>
 #include <condition_variable>
 #include <cstdlib>
 #include <cstdio>
@@ -45,6 +47,7 @@
 #include <fstream>
 #include <sstream>
 #include <iterator>
+#include <list>
 #include <stdexcept>
 #include <thread>
 #include "util/Finally.h"
@@ -428,12 +431,14 @@ namespace {
   }
 }
 
+static const int OUTPUT_EVENT_MAX_SIZE = 65536;
+static const int OUTPUT_EVENT_INITIAL_CAPACITY = 4096;
+static const long long OUTPUT_SPILL_FILE_MAX_SIZE = 64 << 20;
+static const size_t OUTPUT_SPILL_TAIL_SIZE = 16384;
+
 RPIServiceImpl::RPIServiceImpl() :
   replOutputHandler([&](const char* buf, int len, OutputType type) {
-    AsyncEvent event;
-    event.mutable_text()->set_type(type == STDOUT ? CommandOutput::STDOUT : CommandOutput::STDERR);
-    event.mutable_text()->set_text(buf, len);
-    asyncEvents.push(event);
+    writeReplOutput(buf, len, type);
   }) {
   std::cerr << "rpi service impl constructor\n";
 }
@@ -444,8 +449,149 @@ void RPIServiceImpl::writeToReplOutputHandler(std::string const& s, OutputType t
   replOutputHandler(s.c_str(), s.size(), type);
 }
 
+template <typename TimePoint>
+bool RPIServiceImpl::pushOutputEvent(const char* buf, int len, CommandOutput_Type type, TimePoint const& deadline) {
+  // Consecutive writes are appended to the pending text event, so printing many short lines
+  // doesn't create an event for each of them
+  return asyncEvents.pushOrMergeWithDeadline(deadline, [&](AsyncEvent& last) {
+    if (!last.has_text() || last.text().type() != type) return false;
+    if (last.text().text().size() + len > (size_t)OUTPUT_EVENT_MAX_SIZE) return false;
+    last.mutable_text()->mutable_text()->append(buf, len);
+    return true;
+  }, [&] {
+    AsyncEvent event;
+    event.mutable_text()->set_type(type);
+    event.mutable_text()->mutable_text()->reserve(std::max(len, OUTPUT_EVENT_INITIAL_CAPACITY));
+    event.mutable_text()->mutable_text()->append(buf, len);
+    return event;
+  });
+}
+
+// R sets R_SESSION_TMPDIR to its session directory, there is no spill file until then
+static std::string getOutputSpillPath() {
+  const char* tempDir = getenv("R_SESSION_TMPDIR");
+  return tempDir != nullptr && tempDir[0] != 0 ? std::string(tempDir) + "/console-output.txt" : "";
+}
+
+void RPIServiceImpl::writeReplOutput(const char* buf, int len, OutputType type) {
+  auto textType = type == STDOUT ? CommandOutput::STDOUT : CommandOutput::STDERR;
+  int stallTimeout = commandLineOptions.outputStallTimeoutMs;
+  if (stallTimeout <= 0) {
+    while (!pushOutputEvent(buf, len, textType, std::chrono::steady_clock::now() + std::chrono::seconds(1)));
+    return;
+  }
+  std::unique_lock<std::mutex> lock(outputSpillMutex);
+  if (isSpillingOutput) {
+    // Keep spilling until the client has taken everything, otherwise each freed slot would produce a short note
+    if (!asyncEvents.isEmpty()) {
+      spillOutput(buf, len, textType);
+      return;
+    }
+    endOutputSpill();
+  }
+  if (pushOutputEvent(buf, len, textType, std::chrono::steady_clock::now() + std::chrono::milliseconds(stallTimeout))) {
+    return;
+  }
+  if (!outputSpillFile.is_open() && outputSpillPath.empty()) {
+    // The file is opened once per session, each flood is appended to it until it reaches OUTPUT_SPILL_FILE_MAX_SIZE
+    outputSpillPath = getOutputSpillPath();
+    if (!outputSpillPath.empty()) {
+      outputSpillFile.open(outputSpillPath, std::ios::binary | std::ios::out | std::ios::trunc);
+    }
+  }
+  isSpillingOutput = true;
+  spilledLines = 0;
+  spilledBytes = 0;
+  outputSpillOffset = outputSpillFileSize;
+  spillOutput(buf, len, textType);
+}
+
+void RPIServiceImpl::spillOutput(const char* buf, int len, CommandOutput_Type type) {
+  spilledLines += std::count(buf, buf + len, '\n');
+  spilledBytes += len;
+  if (outputSpillFile.is_open() && outputSpillFileSize < OUTPUT_SPILL_FILE_MAX_SIZE) {
+    int size = (int)std::min<long long>(len, OUTPUT_SPILL_FILE_MAX_SIZE - outputSpillFileSize);
+    outputSpillFile.write(buf, size);
+    outputSpillFileSize += size;
+  }
+  // Only the last OUTPUT_SPILL_TAIL_SIZE bytes are kept to be shown after the note
+  if (!outputSpillTail.empty() && outputSpillTail.back().first == type) {
+    outputSpillTail.back().second.append(buf, len);
+  } else {
+    outputSpillTail.emplace_back(type, std::string(buf, len));
+  }
+  outputSpillTailSize += len;
+  while (outputSpillTailSize - outputSpillTail.front().second.size() >= OUTPUT_SPILL_TAIL_SIZE) {
+    outputSpillTailSize -= outputSpillTail.front().second.size();
+    outputSpillTail.pop_front();
+  }
+  if (outputSpillTailSize > 2 * OUTPUT_SPILL_TAIL_SIZE) {
+    size_t extra = outputSpillTailSize - OUTPUT_SPILL_TAIL_SIZE;
+    outputSpillTail.front().second.erase(0, extra);
+    outputSpillTailSize -= extra;
+  }
+}
+
+// Sends the note about the spilled output followed by its tail, must be called with `outputSpillMutex` held
+void RPIServiceImpl::endOutputSpill() {
+  if (outputSpillTailSize < (size_t)spilledBytes && !outputSpillTail.empty()) {
+    // The tail starts with a whole line, unless the line is longer than the tail
+    std::string& first = outputSpillTail.front().second;
+    size_t lineEnd = first.find('\n');
+    if (lineEnd != std::string::npos && lineEnd + 1 < first.size()) {
+      first.erase(0, lineEnd + 1);
+      outputSpillTailSize -= lineEnd + 1;
+    }
+  }
+  long long tailLines = 0;
+  for (auto const& chunk : outputSpillTail) {
+    tailLines += std::count(chunk.second.begin(), chunk.second.end(), '\n');
+  }
+  long long elidedBytes = spilledBytes - (long long)outputSpillTailSize;
+  if (elidedBytes > 0) {
+    long long savedBytes = outputSpillFileSize - outputSpillOffset;
+    std::string note = "\n... " + std::to_string(spilledLines - tailLines) + " lines (" +
+                       std::to_string(elidedBytes) + " bytes) elided";
+    if (savedBytes > 0) {
+      outputSpillFile.flush();
+      note += savedBytes < spilledBytes ? ", the first " + std::to_string(savedBytes) + " bytes of the output are in "
+                                        : ", full output is in ";
+      note += outputSpillPath + " from byte " + std::to_string(outputSpillOffset);
+    }
+    note += " ...\n";
+    AsyncEvent event;
+    event.mutable_text()->set_type(CommandOutput::STDERR);
+    event.mutable_text()->set_text(note);
+    asyncEvents.push(std::move(event));
+  }
+  for (auto& chunk : outputSpillTail) {
+    AsyncEvent tailEvent;
+    tailEvent.mutable_text()->set_type(chunk.first);
+    tailEvent.mutable_text()->mutable_text()->swap(chunk.second);
+    asyncEvents.push(std::move(tailEvent));
+  }
+  outputSpillTail.clear();
+  outputSpillTailSize = 0;
+  isSpillingOutput = false;
+  spilledLines = 0;
+  spilledBytes = 0;
+}
+
+void RPIServiceImpl::endOutputSpillIfIdle() {
+  // Called by the consumer of the events, so it must not wait for a producer which may be blocked on the queue
+  std::unique_lock<std::mutex> lock(outputSpillMutex, std::try_to_lock);
+  if (lock.owns_lock() && isSpillingOutput && asyncEvents.isEmpty()) endOutputSpill();
+}
+
+void RPIServiceImpl::pushAsyncEvent(AsyncEvent event) {
+  std::unique_lock<std::mutex> lock(outputSpillMutex);
+  // The note about the spilled output must come before whatever follows it (e.g. the prompt)
+  if (isSpillingOutput) endOutputSpill();
+  asyncEvents.push(std::move(event));
+}
+
 void RPIServiceImpl::sendAsyncRequestAndWait(AsyncEvent const& e) {
-  asyncEvents.push(e);
+  pushAsyncEvent(e);
   ScopedAssign<bool> with(isInClientRequest, true);
   runEventLoop();
 }
@@ -677,7 +823,7 @@ Status RPIServiceImpl::commitDataImport(ServerContext* context, const CommitData
 void RPIServiceImpl::mainLoop() {
   AsyncEvent event;
   event.mutable_prompt();
-  asyncEvents.push(event);
+  pushAsyncEvent(std::move(event));
   ScopedAssign<ReplState> withState(replState, PROMPT);
   WithOutputHandler withOutputHandler(replOutputHandler);
 #pragma clang diagnostic push
@@ -691,9 +837,11 @@ void RPIServiceImpl::mainLoop() {
     RDebugger::setBytecodeEnabled(true);
     rDebugger.disable();
     rDebugger.clearSavedStack();
+    invalidateDereferenceCache();
     if (replState != PROMPT) {
-      event.mutable_prompt();
-      asyncEvents.push(event);
+      AsyncEvent promptEvent;
+      promptEvent.mutable_prompt();
+      pushAsyncEvent(std::move(promptEvent));
       replState = PROMPT;
     }
   }
@@ -705,34 +853,147 @@ void RPIServiceImpl::setChildProcessState() {
 }
 
 void RPIServiceImpl::sendAsyncEvent(AsyncEvent const& e) {
-  asyncEvents.push(e);
+  pushAsyncEvent(e);
 }
 
-void RPIServiceImpl::executeOnMainThread(std::function<void()> const& f, ServerContext* context, bool immediate) {
-  static const int STATE_PENDING = 0;
-  static const int STATE_RUNNING = 1;
-  static const int STATE_INTERRUPTING = 2;
-  static const int STATE_INTERRUPTED = 3;
-  static const int STATE_DONE = 4;
-  std::atomic_int state(STATE_PENDING);
+namespace {
+const int CANCELLATION_CHECK_INTERVAL_MS = 25;
+
+// The synchronous gRPC API has no done-callback for a server context (`AsyncNotifyWhenDone` is only
+// for the async API), so the pending `executeOnMainThread` calls which have a context are checked
+// for cancellation by a single thread. It sleeps while there is nothing to watch.
+// Calls of the callback API are notified by gRPC instead, see `MainThreadCallReactor`
+class CancellationWatcher {
+private:
+  struct Entry {
+    std::function<bool()> isCancelled;
+    std::function<void()> onCancelled;
+  };
+
+public:
+  class Watch {
+  public:
+    Watch(CancellationWatcher& watcher, std::list<Entry>::iterator it) : watcher(watcher), it(it) {}
+    ~Watch() { watcher.remove(it); }
+  private:
+    CancellationWatcher& watcher;
+    std::list<Entry>::iterator it;
+  };
+
+  // `onCancelled` is called once on the watcher thread as soon as `isCancelled` returns true
+  std::unique_ptr<Watch> watch(std::function<bool()> isCancelled, std::function<void()> onCancelled) {
+    std::unique_lock<std::mutex> lock(mutex);
+    if (!isStarted) {
+      isStarted = true;
+      std::thread([this] { run(); }).detach();
+    }
+    entries.push_front(Entry{std::move(isCancelled), std::move(onCancelled)});
+    condVar.notify_one();
+    return std::make_unique<Watch>(*this, entries.begin());
+  }
+
+private:
+  std::mutex mutex;
+  std::condition_variable condVar;
+  std::list<Entry> entries;
+  bool isStarted = false;
+
+  void remove(std::list<Entry>::iterator it) {
+    std::unique_lock<std::mutex> lock(mutex);
+    entries.erase(it);
+  }
+
+  void run() {
+    std::unique_lock<std::mutex> lock(mutex);
+    while (true) {
+      condVar.wait(lock, [&] { return !entries.empty(); });
+      condVar.wait_for(lock, std::chrono::milliseconds(CANCELLATION_CHECK_INTERVAL_MS));
+      for (auto& entry : entries) {
+        if (entry.onCancelled && entry.isCancelled()) {
+          entry.onCancelled();
+          entry.onCancelled = nullptr;
+        }
+      }
+    }
+  }
+};
+
+// Note: never destroyed since the watcher thread is detached
+CancellationWatcher& cancellationWatcher = *new CancellationWatcher();
+}
+
+namespace {
+const int STATE_PENDING = 0;
+const int STATE_RUNNING = 1;
+const int STATE_INTERRUPTING = 2;
+const int STATE_INTERRUPTED = 3;
+const int STATE_DONE = 4;
+const int STATE_CANCELLED = 5;
+
+// State of a call which is executed on the main thread, shared by the caller and the task
+struct MainThreadCallState {
+  std::atomic_int state{STATE_PENDING};
   std::mutex mutex;
-  std::unique_lock<std::mutex> lock(mutex);
   std::condition_variable condVar;
+  bool cancellationRequested = false;
+  std::unique_ptr<CancellationWatcher::Watch> watch;
+};
 
-  eventLoopExecute([&] {
+// Part of the task of a call, which cancels the call if the task is destroyed without being run.
+// That's what happens to the pending tasks on termination, see `discardEventLoopTasks`
+class PendingCallGuard {
+public:
+  PendingCallGuard(std::shared_ptr<MainThreadCallState> call, std::function<void()> onCancelled)
+      : call(std::move(call)), onCancelled(std::move(onCancelled)) {}
+  PendingCallGuard(PendingCallGuard&&) = default;
+  ~PendingCallGuard() {
+    int expected = STATE_PENDING;
+    if (call != nullptr && call->state.compare_exchange_strong(expected, STATE_CANCELLED)) onCancelled();
+  }
+private:
+  std::shared_ptr<MainThreadCallState> call;
+  std::function<void()> onCancelled;
+};
+}
+
+void RPIServiceImpl::executeOnMainThread(std::function<void()> const& f, ServerContext* context, bool immediate) {
+  auto call = std::make_shared<MainThreadCallState>();
+  auto wakeUp = [call] {
+    std::unique_lock<std::mutex> lock(call->mutex);
+    call->cancellationRequested = true;
+    call->condVar.notify_one();
+  };
+  // Calls without a context can't be cancelled, only termination has to wake them up,
+  // which is done by cancelling their pending tasks
+  if (context != nullptr) {
+    call->watch = cancellationWatcher.watch([=] {
+      return terminateProceed || context->IsCancelled();
+    }, wakeUp);
+  }
+  std::unique_lock<std::mutex> lock(call->mutex);
+
+  eventLoopExecute([&, call, guard = PendingCallGuard(call, wakeUp)] {
     R_interrupts_pending = 0;
     int expected = STATE_PENDING;
-    if (!state.compare_exchange_strong(expected, STATE_RUNNING)) return;
+    if (!call->state.compare_exchange_strong(expected, STATE_RUNNING)) return;
+    if (context != nullptr && context->IsCancelled()) {
+      // Note: the RPC was cancelled before the task was started, let the waiter interrupt it right away
+      wakeUp();
+    }
     auto finally = Finally{[&] {
-      std::unique_lock<std::mutex> lock1(mutex);
+      if (!immediate) invalidateDereferenceCache();
+      std::unique_lock<std::mutex> lock1(call->mutex);
       int value = STATE_RUNNING;
-      if (!state.compare_exchange_strong(value, STATE_DONE) && value == STATE_INTERRUPTING) {
-        condVar.wait(lock1, [&] { return state.load() == STATE_INTERRUPTED; });
+      if (!call->state.compare_exchange_strong(value, STATE_DONE) && value == STATE_INTERRUPTING) {
+        call->condVar.wait(lock1, [&] { return call->state.load() == STATE_INTERRUPTED; });
       }
-      state.store(STATE_DONE);
-      condVar.notify_one();
+      call->state.store(STATE_DONE);
+      call->condVar.notify_one();
       R_interrupts_pending = 0;
     }};
+    // Immediate tasks which may run user code (evaluateAs*, expression references) invalidate the cache themselves,
+    // other tasks may run arbitrary code
+    if (!immediate) invalidateDereferenceCache();
     try {
       f();
     } catch (RUnwindException const&) {
@@ -745,19 +1006,22 @@ void RPIServiceImpl::executeOnMainThread(std::function<void()> const& f, ServerC
   }, immediate);
   bool cancelled = false;
   while (!terminateProceed) {
-    int currentState = state.load();
-    if (currentState == STATE_DONE) break;
-    if (currentState == STATE_RUNNING && !cancelled && context != nullptr && context->IsCancelled()) {
+    int currentState = call->state.load();
+    if (currentState == STATE_DONE || currentState == STATE_CANCELLED) break;
+    if (currentState == STATE_RUNNING && !cancelled && call->cancellationRequested && context != nullptr) {
       int expected = STATE_RUNNING;
-      if (state.compare_exchange_strong(expected, STATE_INTERRUPTING)) {
+      if (call->state.compare_exchange_strong(expected, STATE_INTERRUPTING)) {
         cancelled = true;
         asyncInterrupt();
-        state.store(STATE_INTERRUPTED);
-        condVar.notify_one();
+        call->state.store(STATE_INTERRUPTED);
+        call->condVar.notify_one();
       }
     }
-    condVar.wait_for(lock, std::chrono::milliseconds(25));
+    call->condVar.wait(lock);
   }
+  // Note: the watcher may be calling `wakeUp` right now, so it must be able to acquire the mutex
+  lock.unlock();
+  call->watch = nullptr;
 }
 
 std::unique_ptr<RPIServiceImpl> rpiService;
@@ -820,6 +1084,71 @@ private:
 
 TerminationTimer* terminationTimer;
 
+namespace {
+// Reactor of a call of `executeOnMainThreadAsync`. gRPC calls `OnCancel` when the client cancels the call
+// or the server shuts down, which finishes the call right away if its task hasn't started yet
+// and interrupts the task otherwise (same protocol as in `executeOnMainThread`, with `OnCancel` as the waiter)
+class MainThreadCallReactor : public ServerUnaryReactor {
+public:
+  std::shared_ptr<MainThreadCallState> call = std::make_shared<MainThreadCallState>();
+
+  void cancel() {
+    int expected = STATE_PENDING;
+    if (call->state.compare_exchange_strong(expected, STATE_CANCELLED)) {
+      Finish(Status::CANCELLED);
+      return;
+    }
+    std::unique_lock<std::mutex> lock(call->mutex);
+    expected = STATE_RUNNING;
+    if (call->state.compare_exchange_strong(expected, STATE_INTERRUPTING)) {
+      asyncInterrupt();
+      call->state.store(STATE_INTERRUPTED);
+      call->condVar.notify_one();
+    }
+  }
+
+  void OnCancel() override { cancel(); }
+  void OnDone() override { delete this; }
+};
+}
+
+ServerUnaryReactor* RPIServiceImpl::executeOnMainThreadAsync(CallbackServerContext* context, std::function<void()> f) {
+  // Callback methods are not reported to the global callbacks of the server
+  if (terminationTimer != nullptr) terminationTimer->PreSynchronousRequest(nullptr);
+  auto reactor = new MainThreadCallReactor();
+  // The reactor is deleted once the call is finished, so the task only uses it until it calls `Finish`
+  std::shared_ptr<MainThreadCallState> call = reactor->call;
+  eventLoopExecute([=, guard = PendingCallGuard(call, [=] { reactor->Finish(Status::CANCELLED); })] {
+    R_interrupts_pending = 0;
+    int expected = STATE_PENDING;
+    if (!call->state.compare_exchange_strong(expected, STATE_RUNNING)) return;
+    Status status = Status::OK;
+    auto finally = Finally{[&] {
+      std::unique_lock<std::mutex> lock(call->mutex);
+      int value = STATE_RUNNING;
+      if (!call->state.compare_exchange_strong(value, STATE_DONE) && value == STATE_INTERRUPTING) {
+        call->condVar.wait(lock, [&] { return call->state.load() == STATE_INTERRUPTED; });
+      }
+      call->state.store(STATE_DONE);
+      lock.unlock();
+      R_interrupts_pending = 0;
+      reactor->Finish(status);
+    }};
+    try {
+      f();
+    } catch (AsyncCallError const& e) {
+      status = e.status;
+    } catch (RUnwindException const&) {
+      throw;
+    } catch (std::exception const& e) {
+      std::cerr << "Exception: " << e.what() << "\n";
+    } catch (...) {
+      std::cerr << "Exception: unknown\n";
+    }
+  }, true);
+  return reactor;
+}
+
 void initRPIService() {
   rpiService = std::make_unique<RPIServiceImpl>();
   if (commandLineOptions.withTimeout) {
@@ -842,11 +1171,13 @@ void quitRPIService() {
   rpiService->terminate = true;
   AsyncEvent event;
   event.mutable_termination();
-  rpiService->asyncEvents.push(event);
+  rpiService->pushAsyncEvent(std::move(event));
   for (int iter = 0; iter < 100 && !rpiService->terminateProceed; ++iter) {
     std::this_thread::sleep_for(std::chrono::milliseconds(25));
   }
   rpiService->terminateProceed = true;
+  // Wakes up the RPCs which wait for the main thread, the server waits for them to return
+  discardEventLoopTasks();
   server->Shutdown(std::chrono::system_clock::now() + std::chrono::seconds(1));
   R_interrupts_pending = false;
   server = nullptr;
@@ -20,7 +20,12 @@
 
 #include "protos/service.grpc.pb.h"
 #include <string>
+#include <atomic>
+#include <deque>
+#include <fstream>
 #include <functional>
+#include <mutex>
+#include <unordered_map>
 #include "util/BlockingQueue.h"
 #include "util/IndexedStorage.h"
 #include "IO.h"
@@ -31,11 +36,34 @@
 using grpc::Status;
 using grpc::ServerContext;
 using grpc::ServerWriter;
+using grpc::CallbackServerContext;
+using grpc::ServerUnaryReactor;
 using namespace rplugininterop;
 using namespace classes;
 using namespace google::protobuf;
 
-class RPIServiceImpl : public RPIService::Service {
+// Thrown from the body of `executeOnMainThreadAsync` to finish the call with an error status
+// instead of an empty response
+struct AsyncCallError {
+  Status status;
+};
+
+// RPCs which only wait for the main thread are served by the callback API,
+// so a call which is pending while R is busy doesn't hold a thread of the server
+using RPIServiceBase =
+    RPIService::WithCallbackMethod_loaderGetParentEnvs<
+    RPIService::WithCallbackMethod_loaderGetVariables<
+    RPIService::WithCallbackMethod_loaderGetLoadedNamespaces<
+    RPIService::WithCallbackMethod_loaderGetValueInfo<
+    RPIService::WithCallbackMethod_dataFrameRegister<
+    RPIService::WithCallbackMethod_dataFrameGetInfo<
+    RPIService::WithCallbackMethod_dataFrameGetData<
+    RPIService::WithCallbackMethod_dataFrameSort<
+    RPIService::WithCallbackMethod_dataFrameFilter<
+    RPIService::WithCallbackMethod_dataFrameRefresh<
+    RPIService::Service>>>>>>>>>>;
+
+class RPIServiceImpl : public RPIServiceBase {
 public:
   RPIServiceImpl();
   ~RPIServiceImpl() override;
@@ -68,10 +96,10 @@ public:
   Status copyToPersistentRef(ServerContext* context, const RRef* request, CopyToPersistentRefResponse* response) override;
   Status disposePersistentRefs(ServerContext* context, const PersistentRefList* request, Empty*) override;
 
-  Status loaderGetParentEnvs(ServerContext* context, const RRef* request, ParentEnvsResponse* response) override;
-  Status loaderGetVariables(ServerContext* context, const GetVariablesRequest* request, VariablesResponse* response) override;
-  Status loaderGetLoadedNamespaces(ServerContext* context, const Empty*, StringList* response) override;
-  Status loaderGetValueInfo(ServerContext* context, const RRef* request, ValueInfo* response) override;
+  ServerUnaryReactor* loaderGetParentEnvs(CallbackServerContext* context, const RRef* request, ParentEnvsResponse* response) override;
+  ServerUnaryReactor* loaderGetVariables(CallbackServerContext* context, const GetVariablesRequest* request, VariablesResponse* response) override;
+  ServerUnaryReactor* loaderGetLoadedNamespaces(CallbackServerContext* context, const Empty*, StringList* response) override;
+  ServerUnaryReactor* loaderGetValueInfo(CallbackServerContext* context, const RRef* request, ValueInfo* response) override;
   Status evaluateAsText(ServerContext* context, const RRef* request, StringOrError* response) override;
   Status evaluateAsBoolean(ServerContext* context, const RRef* request, BoolValue* response) override;
   Status getDistinctStrings(ServerContext* context, const RRef* request, StringList* response) override;
@@ -117,12 +145,12 @@ public:
   Status previewDataImport(ServerContext* context, const PreviewDataImportRequest* request, ServerWriter<CommandOutput>* writer) override;
   Status commitDataImport(ServerContext* context, const CommitDataImportRequest* request, Empty*) override;
 
-  Status dataFrameRegister(ServerContext* context, const RRef* request, Int32Value* response) override;
-  Status dataFrameGetInfo(ServerContext* context, const RRef* request, DataFrameInfoResponse* response) override;
-  Status dataFrameGetData(ServerContext* context, const DataFrameGetDataRequest* request, DataFrameGetDataResponse* response) override;
-  Status dataFrameSort(ServerContext* context, const DataFrameSortRequest* request, Int32Value* response) override;
-  Status dataFrameFilter(ServerContext* context, const DataFrameFilterRequest* request, Int32Value* response) override;
-  Status dataFrameRefresh(ServerContext* context, const RRef* request, BoolValue* response) override;
+  ServerUnaryReactor* dataFrameRegister(CallbackServerContext* context, const RRef* request, Int32Value* response) override;
+  ServerUnaryReactor* dataFrameGetInfo(CallbackServerContext* context, const RRef* request, DataFrameInfoResponse* response) override;
+  ServerUnaryReactor* dataFrameGetData(CallbackServerContext* context, const DataFrameGetDataRequest* request, DataFrameGetDataResponse* response) override;
+  ServerUnaryReactor* dataFrameSort(CallbackServerContext* context, const DataFrameSortRequest* request, Int32Value* response) override;
+  ServerUnaryReactor* dataFrameFilter(CallbackServerContext* context, const DataFrameFilterRequest* request, Int32Value* response) override;
+  ServerUnaryReactor* dataFrameRefresh(CallbackServerContext* context, const RRef* request, BoolValue* response) override;
 
   Status getWorkingDir(ServerContext* context, const Empty*, StringValue* response) override;
   Status setWorkingDir(ServerContext* context, const StringValue* request, Empty*) override;
@@ -167,20 +195,50 @@ public:
   volatile bool terminateProceed = false;
 
   void executeOnMainThread(std::function<void()> const& f, ServerContext* contextForCancellation = nullptr, bool immediate = false);
+  // Runs `f` as an immediate task and finishes the call when it's done, without blocking the calling thread.
+  // `f` must not refer to the locals of the caller
+  ServerUnaryReactor* executeOnMainThreadAsync(CallbackServerContext* context, std::function<void()> f);
 
   OutputHandler getOutputHandlerForChildProcess();
 
   void setValueImpl(RRef const& ref, SEXP value);
   SEXP dereference(RRef const& ref);
+  void invalidateDereferenceCache();
 
   OutputHandler replOutputHandler;
   void writeToReplOutputHandler(std::string const& s, OutputType type);
+  void writeReplOutput(const char* buf, int len, OutputType type);
 
   IndexedStorage<PrSEXP> persistentRefStorage;
 
+  // Async events and the stream messages they were coalesced into, for tuning getAsyncEvents
+  std::atomic<long long> asyncEventsSent{0};
+  std::atomic<long long> asyncMessagesSent{0};
+
 private:
   BlockingQueue<AsyncEvent> asyncEvents;
 
+  // All events except console output go through this, so that they are ordered after the note about spilled output
+  void pushAsyncEvent(AsyncEvent event);
+
+  template <typename TimePoint>
+  bool pushOutputEvent(const char* buf, int len, CommandOutput_Type type, TimePoint const& deadline);
+  void spillOutput(const char* buf, int len, CommandOutput_Type type);
+  void endOutputSpill();
+  void endOutputSpillIfIdle();
+  // Output which the client didn't take in time goes to a size-limited file, so R doesn't wait for the IDE
+  // to render it. The client gets a note about the elided part and the tail of the output
+  std::mutex outputSpillMutex;
+  std::ofstream outputSpillFile;
+  std::string outputSpillPath;
+  long long outputSpillFileSize = 0;
+  bool isSpillingOutput = false;
+  long long spilledLines = 0;
+  long long spilledBytes = 0;
+  long long outputSpillOffset = 0;
+  std::deque<std::pair<CommandOutput_Type, std::string>> outputSpillTail;
+  size_t outputSpillTailSize = 0;
+
   enum ReplState {
     PROMPT, DEBUG_PROMPT, READ_LINE, REPL_BUSY, CHILD_PROCESS, SUBPROCESS_INPUT
   };
@@ -195,6 +253,11 @@ private:
 
   std::vector<RDebuggerStackFrame> lastErrorStack;
 
+  // Results of `dereference` keyed by the serialized RRef. They are reused only while R waits at a prompt
+  // and are dropped whenever R code may have been run
+  std::unordered_map<std::string, PrSEXP> dereferenceCache;
+  SEXP dereferenceImpl(RRef const& ref);
+
   Status executeCommand(ServerContext* context, const std::string& command, ServerWriter<CommandOutput>* writer);
 
   Status replExecuteCommand(ServerContext* context, const std::string& command);
@@ -278,20 +278,20 @@ void RPIServiceImpl::showHelpHandler(std::string const& content, std::string con
   event.mutable_showhelprequest()->set_success(true);
   event.mutable_showhelprequest()->set_content(content);
   event.mutable_showhelprequest()->set_url(url);
-  asyncEvents.push(event);
+  pushAsyncEvent(std::move(event));
 }
 
 void RPIServiceImpl::browseURLHandler(const std::string &url) {
   AsyncEvent event;
   event.set_browseurlrequest(url);
-  asyncEvents.push(event);
+  pushAsyncEvent(std::move(event));
 }
 
 RObject RPIServiceImpl::rStudioApiRequest(int32_t functionID, const RObject &args) {
   AsyncEvent event;
   event.mutable_rstudioapirequest()->set_functionid(functionID);
   event.mutable_rstudioapirequest()->set_allocated_args(new RObject(args));
-  asyncEvents.push(event);
+  pushAsyncEvent(std::move(event));
   ScopedAssign<bool> with(isInRStudioApiRequest, true);
   int timeout;
   if ((functionID < 8 || functionID > 15) && functionID != DOCUMENT_NEW_ID) {
@@ -330,42 +330,79 @@ Status RPIServiceImpl::rStudioApiResponse(ServerContext* context, const RObject*
   return Status::OK;
 }
 
-static const int CACHED_TEXT_LENGTH_LIMIT = 200000;
-static const auto ASYNC_EVENT_TIMEOUT = std::chrono::milliseconds(60);
+// A single write after a pause (e.g. echo of an interactive command) is sent at once.
+// While the output keeps coming, the batch window and size grow, and they shrink back only
+// when nothing has come for ASYNC_EVENT_IDLE_TIMEOUT
+static const size_t CACHED_TEXT_MIN_LIMIT = 16384;
+static const size_t CACHED_TEXT_MAX_LIMIT = 1 << 20;
+static const auto ASYNC_EVENT_MIN_TIMEOUT = std::chrono::milliseconds(4);
+static const auto ASYNC_EVENT_MAX_TIMEOUT = std::chrono::milliseconds(100);
+static const auto ASYNC_EVENT_IDLE_TIMEOUT = std::chrono::milliseconds(60);
 
 Status RPIServiceImpl::getAsyncEvents(ServerContext* context, const Empty*, ServerWriter<AsyncEvent>* writer) {
   asyncEvents.setMaxSize(8);
-  auto deadline = std::chrono::steady_clock::now() + ASYNC_EVENT_TIMEOUT;
+  size_t cachedTextLimit = CACHED_TEXT_MIN_LIMIT;
+  auto cachedTextTimeout = ASYNC_EVENT_MIN_TIMEOUT;
+  auto deadline = std::chrono::steady_clock::now() + ASYNC_EVENT_IDLE_TIMEOUT;
+  auto lastTextTime = std::chrono::steady_clock::time_point();
   std::string cachedText;
   CommandOutput_Type cachedTextType = CommandOutput_Type_STDOUT;
+  int cachedEvents = 0;
+  // The text buffer is lent to the same message for every batch, so neither is reallocated
+  AsyncEvent textEvent;
   auto flushCachedText = [&] {
-    deadline = std::chrono::steady_clock::now() + ASYNC_EVENT_TIMEOUT;
+    deadline = std::chrono::steady_clock::now() + ASYNC_EVENT_IDLE_TIMEOUT;
     if (cachedText.empty()) return;
-    AsyncEvent event;
-    event.mutable_text()->set_text(std::move(cachedText));
-    event.mutable_text()->set_type(cachedTextType);
-    cachedText = "";
-    writer->Write(event);
+    auto text = textEvent.mutable_text();
+    text->set_type(cachedTextType);
+    text->mutable_text()->swap(cachedText);
+    writer->Write(textEvent);
+    text->mutable_text()->swap(cachedText);
+    cachedText.clear();
+    asyncEventsSent += cachedEvents;
+    ++asyncMessagesSent;
+    cachedEvents = 0;
   };
 
   AsyncEvent event;
   while (!context->IsCancelled() && !terminateProceed) {
     if (asyncEvents.popWithDeadline(deadline, event)) {
       if (event.has_text()) {
+        auto now = std::chrono::steady_clock::now();
+        bool isAfterPause = now - lastTextTime >= ASYNC_EVENT_IDLE_TIMEOUT;
+        lastTextTime = now;
         if (event.text().type() != cachedTextType) {
           flushCachedText();
           cachedTextType = event.text().type();
         }
+        if (cachedText.empty()) {
+          deadline = now + cachedTextTimeout;
+        }
         cachedText += event.text().text();
-        if (cachedText.length() > CACHED_TEXT_LENGTH_LIMIT) {
+        ++cachedEvents;
+        if (cachedText.length() >= cachedTextLimit) {
+          flushCachedText();
+          cachedTextLimit = std::min(cachedTextLimit * 2, CACHED_TEXT_MAX_LIMIT);
+          cachedTextTimeout = std::min(cachedTextTimeout * 2, ASYNC_EVENT_MAX_TIMEOUT);
+        } else if (isAfterPause && cachedEvents == 1 && asyncEvents.isEmpty()) {
           flushCachedText();
         }
       } else {
         flushCachedText();
         writer->Write(event);
+        ++asyncEventsSent;
+        ++asyncMessagesSent;
       }
+    } else if (!cachedText.empty()) {
+      // The batch window has passed while the output goes on, let the next batches collect more
+      if (cachedEvents > 1) cachedTextTimeout = std::min(cachedTextTimeout * 2, ASYNC_EVENT_MAX_TIMEOUT);
+      flushCachedText();
     } else {
+      // Nothing has come for ASYNC_EVENT_IDLE_TIMEOUT
       flushCachedText();
+      endOutputSpillIfIdle();
+      cachedTextLimit = CACHED_TEXT_MIN_LIMIT;
+      cachedTextTimeout = ASYNC_EVENT_MIN_TIMEOUT;
     }
   }
   flushCachedText();
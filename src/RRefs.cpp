@@ -22,10 +22,78 @@
 #include "EventLoop.h"
 #include "RStuff/RObjects.h"
 #include "RLoader.h"
+#include "util/Finally.h"
+#include <list>
+#include <unordered_map>
 
 const int EVALUATE_AS_TEXT_MAX_LENGTH = 500000;
+const int DEREFERENCE_CACHE_MAX_SIZE = 4096;
+
+const int PARSED_EXPRESSIONS_CACHE_SIZE = 256;
+
+// Parsed code of expression refs, from the least to the most recently used.
+// Watches are evaluated again on every debugger step, so code which is used more than once is byte-compiled
+struct ParsedExpression {
+  std::string code;
+  PrSEXP expression;
+  int useCount = 0;
+};
+static std::list<ParsedExpression> parsedExpressions;
+static std::unordered_map<std::string, std::list<ParsedExpression>::iterator> parsedExpressionsIndex;
+
+static SEXP getParsedExpression(std::string const& code) {
+  auto it = parsedExpressionsIndex.find(code);
+  if (it == parsedExpressionsIndex.end()) {
+    PrSEXP expression = parseCode(code);
+    if (parsedExpressions.size() >= PARSED_EXPRESSIONS_CACHE_SIZE) {
+      parsedExpressionsIndex.erase(parsedExpressions.front().code);
+      parsedExpressions.pop_front();
+    }
+    parsedExpressions.push_back({code, expression});
+    it = parsedExpressionsIndex.emplace(code, std::prev(parsedExpressions.end())).first;
+  } else {
+    parsedExpressions.splice(parsedExpressions.end(), parsedExpressions, it->second);
+  }
+  ParsedExpression& entry = *it->second;
+  if (++entry.useCount == 2) {
+    entry.expression = compileParsedExpression(entry.expression);
+  }
+  return entry.expression;
+}
+
+// Expressions may run arbitrary code, so neither their results nor anything derived from them are cached
+// (only their parsed code is, see getParsedExpression)
+static bool containsExpression(RRef const& ref) {
+  switch (ref.ref_case()) {
+    case RRef::kExpression: return true;
+    case RRef::kMember: return containsExpression(ref.member().env());
+    case RRef::kParentEnv: return containsExpression(ref.parentenv().env());
+    case RRef::kListElement: return containsExpression(ref.listelement().list());
+    case RRef::kAttributes: return containsExpression(ref.attributes());
+    default: return false;
+  }
+}
 
 SEXP RPIServiceImpl::dereference(RRef const& ref) {
+  bool isCacheable = (replState == PROMPT || replState == DEBUG_PROMPT) &&
+                     (ref.ref_case() == RRef::kMember || ref.ref_case() == RRef::kParentEnv ||
+                      ref.ref_case() == RRef::kListElement || ref.ref_case() == RRef::kAttributes) &&
+                     !containsExpression(ref);
+  if (!isCacheable) return dereferenceImpl(ref);
+  std::string key = ref.SerializeAsString();
+  auto it = dereferenceCache.find(key);
+  if (it != dereferenceCache.end()) return it->second;
+  PrSEXP result = dereferenceImpl(ref);
+  if (dereferenceCache.size() >= DEREFERENCE_CACHE_MAX_SIZE) dereferenceCache.clear();
+  dereferenceCache.emplace(std::move(key), result);
+  return result;
+}
+
+void RPIServiceImpl::invalidateDereferenceCache() {
+  dereferenceCache.clear();
+}
+
+SEXP RPIServiceImpl::dereferenceImpl(RRef const& ref) {
   switch (ref.ref_case()) {
     case RRef::kPersistentIndex: {
       int i = ref.persistentindex();
@@ -63,8 +131,10 @@ SEXP RPIServiceImpl::dereference(RRef const& ref) {
     }
     case RRef::kExpression: {
       ShieldSEXP env = dereference(ref.expression().env());
-      std::string code = ref.expression().code();
-      return RI->eval(parseCode(code), named("envir", env));
+      ShieldSEXP expression = getParsedExpression(ref.expression().code());
+      // The code may modify the values behind the cached references
+      auto finally = Finally{[&] { invalidateDereferenceCache(); }};
+      return RI->eval(expression, named("envir", env));
     }
     case RRef::kListElement: {
       ShieldSEXP list = dereference(ref.listelement().list());
@@ -106,6 +176,7 @@ Status RPIServiceImpl::disposePersistentRefs(ServerContext*, const PersistentRef
 
 Status RPIServiceImpl::evaluateAsText(ServerContext* context, const RRef* request, StringOrError* response) {
   executeOnMainThread([&] {
+    auto finally = Finally{[&] { invalidateDereferenceCache(); }};
     try {
       PrSEXP value = dereference(*request);
       if (value.type() == STRSXP) {
@@ -124,6 +195,7 @@ Status RPIServiceImpl::evaluateAsText(ServerContext* context, const RRef* reques
 
 Status RPIServiceImpl::evaluateAsBoolean(ServerContext* context, const RRef* request, BoolValue* response) {
   executeOnMainThread([&] {
+    auto finally = Finally{[&] { invalidateDereferenceCache(); }};
     try {
       response->set_value(asBool(dereference(*request)));
     } catch (RExceptionBase const&) {
@@ -479,6 +551,7 @@ Status RPIServiceImpl::setValue(ServerContext* context, const SetValueRequest* r
     try {
       ShieldSEXP value = dereference(request->value());
       setValueImpl(request->ref(), value);
+      invalidateDereferenceCache();
       getValueInfo(value, response);
     } catch (RExceptionBase const& e) {
       response->mutable_error()->set_text(e.what());
@@ -1,6 +1,9 @@
 #include "RStudioApi.h"
+#include "RStuff/RObjects.h"
 
-std::string currentExpr;
+SEXP currentExpr = nullptr;
+
+static const size_t CURRENT_EXPRESSION_MAX_LENGTH = 4096;
 
 SEXP rStudioApiHelper(SEXP args, int id) {
   return toSEXP(rpiService->rStudioApiRequest(id, fromSEXP(args)));
@@ -122,6 +125,16 @@ RObject fromSEXP(SEXP const &expr) {
 RObject currentExpression() {
   RObject result;
   result.set_allocated_rstring(new RObject_RString);
-  result.mutable_rstring()->add_strings(currentExpr);
+  std::string text;
+  if (currentExpr != nullptr && currentExpr != R_NilValue) {
+    ShieldSEXP deparsed = RI->deparse.invokeUnsafeInEnv(R_BaseEnv, RI->quote.lang(currentExpr), named("nlines", 1));
+    text = stringEltUTF8(deparsed, 0);
+    if (text.size() > CURRENT_EXPRESSION_MAX_LENGTH) {
+      size_t length = CURRENT_EXPRESSION_MAX_LENGTH;
+      while (length > 0 && (text[length] & 0xC0) == 0x80) --length;
+      text.resize(length);
+    }
+  }
+  result.mutable_rstring()->add_strings(text);
   return result;
 }
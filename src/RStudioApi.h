@@ -33,7 +33,8 @@
 #define TRANSLATE_LOCAL_URL_ID 39
 #define EXECUTE_COMMAND_ID 40
 
-extern std::string currentExpr;
+// Top level expression which is being executed, deparsed only when the API asks for it
+extern SEXP currentExpr;
 
 SEXP rStudioApiHelper(SEXP args, int id);
 
@@ -0,0 +1,156 @@
+//  Rkernel is an execution kernel for R interpreter
+//  Copyright (C) 2019 JetBrains s.r.o.
+//
+//  This program is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+
+#ifndef RWRAPPER_R_STUFF_FORMAT_REAL_H
+#define RWRAPPER_R_STUFF_FORMAT_REAL_H
+
+#include "RInclude.h"
+#include <algorithm>
+#include <cfloat>
+#include <climits>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+
+// Port of `scientific`, `formatReal` and `encodeReal0` of R's format.c and printutils.c
+// (as they are built with long double, which R's builds are), so that the cells are the same as the elements
+// of `format(x, trim = TRUE)` and the cells of `print(x)` for the given `digits` and `scipen` options.
+// Checked against R by src/tests/FormatRealTest.cpp
+
+static const int FORMAT_REAL_KP_MAX = 27;
+
+// 10^k for -1 <= k <= FORMAT_REAL_KP_MAX, all of them (but the first) are exact in long double
+inline long double formatRealPowerOfTen(int k) {
+  static const long double powers[] = {
+      1e-1L,
+      1e00L, 1e01L, 1e02L, 1e03L, 1e04L, 1e05L, 1e06L, 1e07L, 1e08L, 1e09L,
+      1e10L, 1e11L, 1e12L, 1e13L, 1e14L, 1e15L, 1e16L, 1e17L, 1e18L, 1e19L,
+      1e20L, 1e21L, 1e22L, 1e23L, 1e24L, 1e25L, 1e26L, 1e27L
+  };
+  return powers[k + 1];
+}
+
+struct RealScientificInfo {
+  bool isNegative;
+  // |x| = alpha * 10^exponent, 1 <= alpha < 10
+  int exponent;
+  // Number of significant digits of alpha rounded to `digits` digits
+  int significantDigits;
+  // Rounding to `digits` digits makes the integer part one digit longer (e.g. 9996 with 3 digits is 1e+04)
+  bool roundingWidens;
+};
+
+// Same as `scientific` in R's format.c
+inline RealScientificInfo getRealScientificInfo(double x, int digits) {
+  if (x == 0.0) return RealScientificInfo{false, 0, 1, false};
+  bool isNegative = x < 0;
+  double r = std::fabs(x);
+  if (digits > DBL_DIG) {
+    char buffer[64];
+    snprintf(buffer, sizeof(buffer), "%#.*e", digits - 1, r);
+    int exponent = (int)strtol(buffer + digits + 2, nullptr, 10);
+    int i = digits;
+    while (i >= 2 && buffer[i] == '0') --i;
+    return RealScientificInfo{isNegative, exponent, i, false};
+  }
+  int kp = (int)std::floor(std::log10(r)) - digits + 1;
+  long double scaled = r;
+  if (kp > 0 && kp < 10) {
+    scaled /= formatRealPowerOfTen(kp);
+  } else if (kp < 0 && kp > -10) {
+    scaled *= formatRealPowerOfTen(-kp);
+  } else if (kp != 0) {
+    scaled /= std::pow(10.0L, (long double)kp);
+  }
+  if (scaled < formatRealPowerOfTen(digits - 1)) {
+    scaled *= 10.0;
+    --kp;
+  }
+  double alpha = (double)std::nearbyint(scaled);
+  int significantDigits = digits;
+  for (int j = 1; j <= digits; ++j) {
+    alpha /= 10.0;
+    if (alpha != std::floor(alpha)) break;
+    --significantDigits;
+  }
+  if (significantDigits == 0) {
+    significantDigits = 1;
+    kp += 1;
+  }
+  int exponent = kp + digits - 1;
+  int right = std::min(std::max(digits - exponent, 0), FORMAT_REAL_KP_MAX);
+  double fuzz = 0.5 / (double)formatRealPowerOfTen(right);
+  bool roundingWidens = exponent > 0 && exponent <= FORMAT_REAL_KP_MAX && r < formatRealPowerOfTen(exponent) - fuzz;
+  return RealScientificInfo{isNegative, exponent, significantDigits, roundingWidens};
+}
+
+// Same as `formatReal` (with `nsmall = 0`) followed by `encodeReal0` for every element.
+// `digits` must be within 1..22
+inline std::vector<std::string> formatRealCells(SEXP x, R_xlen_t length, int digits, int scipen) {
+  bool hasNegative = false;
+  int maxLeft = INT_MIN, maxRight = 0, maxSignificant = INT_MIN, maxExponent = INT_MIN, minExponent = INT_MAX;
+  for (R_xlen_t i = 0; i < length; ++i) {
+    double value = REAL_ELT(x, i);
+    if (!R_FINITE(value)) continue;
+    RealScientificInfo info = getRealScientificInfo(value, digits);
+    int left = info.exponent + 1 - (info.roundingWidens ? 1 : 0);
+    int signedLeft = (info.isNegative ? 1 : 0) + (left <= 0 ? 1 : left);
+    hasNegative |= info.isNegative;
+    maxRight = std::max(maxRight, info.significantDigits - left);
+    maxLeft = std::max(maxLeft, signedLeft);
+    maxSignificant = std::max(maxSignificant, info.significantDigits);
+    maxExponent = std::max(maxExponent, info.exponent);
+    minExponent = std::min(minExponent, info.exponent);
+  }
+  bool isScientific = false;
+  int decimals = 0;
+  if (maxSignificant != INT_MIN) {
+    int fixedWidth = maxLeft + maxRight + (maxRight != 0);
+    int exponentDigits = maxExponent >= 100 || minExponent <= -99 ? 2 : 1;
+    int mantissaDecimals = maxSignificant - 1;
+    int scientificWidth = hasNegative + (mantissaDecimals > 0) + mantissaDecimals + 4 + exponentDigits;
+    if (fixedWidth <= scientificWidth + scipen) {
+      decimals = maxRight;
+    } else {
+      isScientific = true;
+      decimals = mantissaDecimals;
+    }
+  }
+  std::vector<std::string> cells;
+  cells.reserve(length);
+  // Same size as the buffer of `encodeReal0`
+  char buffer[1000];
+  for (R_xlen_t i = 0; i < length; ++i) {
+    double value = REAL_ELT(x, i);
+    if (ISNA(value)) {
+      cells.emplace_back("NA");
+    } else if (ISNAN(value)) {
+      cells.emplace_back("NaN");
+    } else if (!R_FINITE(value)) {
+      cells.emplace_back(value > 0 ? "Inf" : "-Inf");
+    } else {
+      if (value == 0.0) value = 0.0;  // Note: drop sign of zero
+      snprintf(buffer, sizeof(buffer), isScientific ? (decimals > 0 ? "%#.*e" : "%.*e") : "%.*f", decimals, value);
+      cells.emplace_back(buffer);
+    }
+  }
+  return cells;
+}
+
+#endif //RWRAPPER_R_STUFF_FORMAT_REAL_H
@@ -0,0 +1,161 @@
+//  Rkernel is an execution kernel for R interpreter
+//  Copyright (C) 2019 JetBrains s.r.o.
+//
+//  This program is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+
+#ifndef RWRAPPER_R_STUFF_OBJECT_SIZE_ESTIMATOR_H
+#define RWRAPPER_R_STUFF_OBJECT_SIZE_ESTIMATOR_H
+
+#include "../RInternals/RInternals.h"
+#include "MySEXP.h"
+#include <algorithm>
+#include <chrono>
+#include <unordered_set>
+
+// Growable list of objects which are kept from being collected while it's alive
+class PreservedList {
+public:
+  void push(SEXP x) {
+    if (size == capacity) grow();
+    SET_VECTOR_ELT(data, size++, x);
+  }
+
+  // The slot isn't cleared, so the object stays protected until the next push
+  SEXP pop() { return VECTOR_ELT(data, --size); }
+
+  bool empty() const { return size == 0; }
+
+private:
+  PrSEXP data;
+  R_xlen_t size = 0;
+  R_xlen_t capacity = 0;
+
+  void grow() {
+    R_xlen_t newCapacity = std::max<R_xlen_t>(capacity * 2, 64);
+    ShieldSEXP newData = Rf_allocVector(VECSXP, newCapacity);
+    for (R_xlen_t i = 0; i < capacity; ++i) {
+      SET_VECTOR_ELT(newData, i, VECTOR_ELT(data, i));
+    }
+    data = newData;
+    capacity = newCapacity;
+  }
+};
+
+// Estimates `object.size` natively, walking the object in small steps so that the walk
+// can be spread over several main thread tasks. Unlike `object.size`, the objects which are
+// reachable in several ways (e.g. shared list elements) are counted only once.
+// As in `object.size`, environments, promises and the enclosures of functions are not included
+class ObjectSizeEstimator {
+public:
+  explicit ObjectSizeEstimator(SEXP x) {
+    stack.push(x);
+  }
+
+  // Walks the object until it's done or the deadline is reached. Returns true when done
+  bool advance(std::chrono::steady_clock::time_point deadline) {
+    int steps = 0;
+    while (!stack.empty()) {
+      if (++steps % STEPS_PER_CLOCK_CHECK == 0 && std::chrono::steady_clock::now() >= deadline) {
+        return false;
+      }
+      SEXP x = stack.pop();
+      if (x == R_NilValue || x == R_UnboundValue || x == NA_STRING || !visited.insert(x).second) continue;
+      visitedObjects.push(x);
+      size += getNodeSize(x);
+      pushChildren(x);
+    }
+    return true;
+  }
+
+  bool isDone() const { return stack.empty(); }
+
+  // A lower bound of the size if the walk is not done yet
+  long long getSize() const { return size; }
+
+private:
+  static const int STEPS_PER_CLOCK_CHECK = 1024;
+  // Same as in R's `objectsize()` for 64-bit builds
+  static const int NODE_SIZE = 56;
+  static const int VECTOR_HEADER_SIZE = 48;
+
+  // User code runs between the steps and may modify the objects in place (e.g. data.table's `set`),
+  // so both the pending and the visited objects are preserved: the former are dereferenced later,
+  // and the addresses of the latter must not be reused by new objects
+  PreservedList stack;
+  PreservedList visitedObjects;
+  std::unordered_set<SEXP> visited;
+  long long size = 0;
+
+  static long long getVectorSize(R_xlen_t bytes) {
+    R_xlen_t units = (bytes + 7) / 8;
+    if (units > 16) return VECTOR_HEADER_SIZE + 8 * units;
+    if (units > 8) return VECTOR_HEADER_SIZE + 128;
+    if (units > 6) return VECTOR_HEADER_SIZE + 64;
+    if (units > 4) return VECTOR_HEADER_SIZE + 48;
+    if (units > 2) return VECTOR_HEADER_SIZE + 32;
+    if (units > 1) return VECTOR_HEADER_SIZE + 16;
+    if (units > 0) return VECTOR_HEADER_SIZE + 8;
+    return VECTOR_HEADER_SIZE;
+  }
+
+  static long long getNodeSize(SEXP x) {
+    switch (TYPEOF(x)) {
+      case CHARSXP: return getVectorSize(LENGTH(x) + 1);
+      case LGLSXP:
+      case INTSXP: return getVectorSize(Rf_xlength(x) * sizeof(int));
+      case REALSXP: return getVectorSize(Rf_xlength(x) * sizeof(double));
+      case CPLXSXP: return getVectorSize(Rf_xlength(x) * sizeof(Rcomplex));
+      case RAWSXP: return getVectorSize(Rf_xlength(x));
+      case STRSXP:
+      case VECSXP:
+      case EXPRSXP: return getVectorSize(Rf_xlength(x) * sizeof(SEXP));
+      default: return NODE_SIZE;
+    }
+  }
+
+  void pushChildren(SEXP x) {
+    // The attributes of a CHARSXP are the hash chain of the global string cache
+    if (TYPEOF(x) != CHARSXP) stack.push(ATTRIB(x));
+    switch (TYPEOF(x)) {
+      case DOTSXP:
+      case LANGSXP:
+      case LISTSXP:
+        // sxpinfo.extra may contain an immediate binding, meaning that CAR(x) should not be called
+        if (!x->sxpinfo.extra) stack.push(CAR(x));
+        stack.push(CDR(x));
+        stack.push(TAG(x));
+        break;
+      case CLOSXP:
+        stack.push(FORMALS(x));
+        stack.push(BODY(x));
+        break;
+      case STRSXP: {
+        R_xlen_t length = Rf_xlength(x);
+        for (R_xlen_t i = 0; i < length; ++i) stack.push(STRING_ELT(x, i));
+        break;
+      }
+      case EXPRSXP:
+      case VECSXP: {
+        R_xlen_t length = Rf_xlength(x);
+        for (R_xlen_t i = 0; i < length; ++i) stack.push(VECTOR_ELT(x, i));
+        break;
+      }
+      default:
+        break;
+    }
+  }
+};
+
+#endif //RWRAPPER_R_STUFF_OBJECT_SIZE_ESTIMATOR_H
@@ -139,9 +139,11 @@ struct RObjects2 {
   PrSEXP vectorNot = baseEnv.getVar("!");
   PrSEXP vectorOr = baseEnv.getVar("|");
   PrSEXP withVisible = baseEnv.getVar("withVisible");
+  PrSEXP xtfrm = baseEnv.getVar("xtfrm");
 
   PrSEXP compiler = loadNamespace("compiler");
   PrSEXP compilerEnableJIT = compiler.getVar("enableJIT");
+  PrSEXP compilerCompile = compiler.getVar("compile");
 
   PrSEXP utils = loadNamespace("utils");
   PrSEXP help = utils.getVar("help");
@@ -155,6 +155,19 @@ inline SEXP parseCode(std::string const& code, bool keepSource = false) {
 #endif
 }
 
+// Byte-compiles the parsed code if it's a single expression, otherwise (or if compilation fails) returns it as is.
+// Inlining is disabled because the expression is evaluated in different environments
+inline SEXP compileParsedExpression(SEXP exprs) {
+  SHIELD(exprs);
+  if (TYPEOF(exprs) != EXPRSXP || Rf_xlength(exprs) != 1) return exprs;
+  try {
+    ShieldSEXP options = RI->list(named("optimize", 0));
+    return RI->compilerCompile(VECTOR_ELT(exprs, 0), named("options", options));
+  } catch (RError const&) {
+    return exprs;
+  }
+}
+
 inline SEXP getBlockSrcrefs(SEXP expr) {
   ShieldSEXP srcrefs = Rf_getAttrib(expr, RI->srcrefAttr);
   if (srcrefs.type() == VECSXP) return srcrefs;
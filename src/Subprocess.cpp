@@ -143,7 +143,7 @@ void RPIServiceImpl::subprocessHandler(
   if (askInput) {
     AsyncEvent event;
     event.mutable_subprocessinput();
-    asyncEvents.push(event);
+    pushAsyncEvent(std::move(event));
   }
   ScopedAssign<ReplState> withState(replState, askInput ? SUBPROCESS_INPUT : replState);
   while (true) {
@@ -159,7 +159,7 @@ void RPIServiceImpl::subprocessHandler(
   if (askInput) {
     AsyncEvent event;
     event.mutable_busy();
-    asyncEvents.push(event);
+    pushAsyncEvent(std::move(event));
   }
 }
 
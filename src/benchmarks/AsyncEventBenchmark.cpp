@@ -0,0 +1,146 @@
+//  Rkernel is an execution kernel for R interpreter
+//  Copyright (C) 2019 JetBrains s.r.o.
+//
+//  This program is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+// Counts the heap allocations of passing async events to getAsyncEvents and of sending the coalesced text,
+// before and after events were moved through the queue and the text message was reused for every batch.
+// The handoff runs push the events built as in `pushAsyncEvent` callers (copied vs moved into the queue)
+// and pop them on the same thread. The batch runs coalesce text events as `getAsyncEvents` does,
+// with a fresh message per batch vs one message which borrows the text buffer; `Write` is replaced
+// by serializing into a preallocated buffer, which is what gRPC does with the message.
+
+#include "protos/service.pb.h"
+#include "../util/BlockingQueue.h"
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <new>
+#include <string>
+#include <vector>
+
+using namespace rplugininterop;
+
+static long long allocations = 0;
+
+void* operator new(size_t size) {
+  ++allocations;
+  void* p = malloc(size == 0 ? 1 : size);
+  if (p == nullptr) throw std::bad_alloc();
+  return p;
+}
+
+void operator delete(void* p) noexcept {
+  free(p);
+}
+
+void operator delete(void* p, size_t) noexcept {
+  free(p);
+}
+
+static const int EVENTS = 100000;
+static const int STACK_FRAMES = 30;
+static const int EVENTS_PER_BATCH = 16;
+static const std::string LINE(120, 'x');
+
+static void buildTextEvent(AsyncEvent& event) {
+  event.mutable_text()->set_type(CommandOutput::STDOUT);
+  event.mutable_text()->set_text(LINE);
+}
+
+static void buildDebugPromptEvent(AsyncEvent& event) {
+  auto prompt = event.mutable_debugprompt();
+  prompt->set_changed(true);
+  for (int i = 0; i < STACK_FRAMES; ++i) {
+    auto frame = prompt->mutable_stack()->add_frames();
+    frame->mutable_position()->set_fileid("gen:" + std::to_string(i));
+    frame->mutable_position()->set_line(i);
+    frame->set_functionname("function_name_" + std::to_string(i));
+    frame->set_sourcepositiontext("source_file_name.R#" + std::to_string(i));
+  }
+}
+
+struct Result {
+  double allocationsPerEvent;
+  double nsPerEvent;
+};
+
+template <typename F>
+static Result measure(F const& f) {
+  long long allocationsBefore = allocations;
+  auto start = std::chrono::steady_clock::now();
+  f();
+  std::chrono::duration<double, std::nano> elapsed = std::chrono::steady_clock::now() - start;
+  return {(double)(allocations - allocationsBefore) / EVENTS, elapsed.count() / EVENTS};
+}
+
+template <typename Build>
+static Result runHandoff(Build const& build, bool move) {
+  BlockingQueue<AsyncEvent> queue;
+  AsyncEvent received;
+  return measure([&] {
+    for (int i = 0; i < EVENTS; ++i) {
+      AsyncEvent event;
+      build(event);
+      if (move) {
+        queue.push(std::move(event));
+      } else {
+        queue.push(event);
+      }
+      queue.poll(received);
+    }
+  });
+}
+
+static Result runBatches(bool reuse) {
+  std::vector<char> wire(1 << 20);
+  AsyncEvent event;
+  buildTextEvent(event);
+  AsyncEvent textEvent;
+  std::string cachedText;
+  auto write = [&](AsyncEvent const& e) {
+    e.SerializeToArray(wire.data(), (int)e.ByteSizeLong());
+  };
+  return measure([&] {
+    for (int i = 0; i < EVENTS; ++i) {
+      cachedText += event.text().text();
+      if ((i + 1) % EVENTS_PER_BATCH != 0) continue;
+      if (reuse) {
+        auto text = textEvent.mutable_text();
+        text->set_type(CommandOutput::STDOUT);
+        text->mutable_text()->swap(cachedText);
+        write(textEvent);
+        text->mutable_text()->swap(cachedText);
+      } else {
+        AsyncEvent batch;
+        batch.mutable_text()->set_type(CommandOutput::STDOUT);
+        batch.mutable_text()->set_text(cachedText);
+        write(batch);
+      }
+      cachedText.clear();
+    }
+  });
+}
+
+static void print(const char* name, Result before, Result after) {
+  printf("%-22s allocations/event %6.2f -> %6.2f, ns/event %7.1f -> %7.1f\n", name,
+         before.allocationsPerEvent, after.allocationsPerEvent, before.nsPerEvent, after.nsPerEvent);
+}
+
+int main() {
+  print("text handoff", runHandoff(buildTextEvent, false), runHandoff(buildTextEvent, true));
+  print("debug prompt handoff", runHandoff(buildDebugPromptEvent, false), runHandoff(buildDebugPromptEvent, true));
+  print("text batches", runBatches(false), runBatches(true));
+  return 0;
+}
@@ -0,0 +1,99 @@
+//  Rkernel is an execution kernel for R interpreter
+//  Copyright (C) 2019 JetBrains s.r.o.
+//
+//  This program is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+// Compares the event loop task queue with the mutex-guarded deque of std::function it replaced.
+// Several producers push small closures while one consumer runs them, as the gRPC threads and the R thread do.
+// In the "flood" run producers never wait, so the ring overflows; in the "bursts" run they keep
+// at most `maxPending` tasks queued, which is the usual case for the event loop.
+
+#include "../util/MPSCQueue.h"
+#include "../util/Task.h"
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+class MutexQueue {
+public:
+  void push(std::function<void()> f) {
+    std::lock_guard<std::mutex> lock(mutex);
+    queue.push_back(std::move(f));
+  }
+
+  bool poll(std::function<void()> &f) {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (queue.empty()) return false;
+    f = std::move(queue.front());
+    queue.pop_front();
+    return true;
+  }
+
+private:
+  std::mutex mutex;
+  std::deque<std::function<void()>> queue;
+};
+
+template <typename Queue, typename Item>
+static double run(int producers, int tasksPerProducer, long long maxPending) {
+  Queue queue;
+  std::atomic<long long> sum(0);
+  std::atomic<long long> pushed(0);
+  long long expected = (long long)producers * tasksPerProducer;
+  auto start = std::chrono::steady_clock::now();
+  std::vector<std::thread> threads;
+  for (int p = 0; p < producers; ++p) {
+    threads.emplace_back([&] {
+      for (int i = 0; i < tasksPerProducer; ++i) {
+        while (maxPending != 0 && pushed.load(std::memory_order_relaxed) - sum.load(std::memory_order_relaxed) >= maxPending) {
+          std::this_thread::yield();
+        }
+        pushed.fetch_add(1, std::memory_order_relaxed);
+        queue.push([&sum] { sum.fetch_add(1, std::memory_order_relaxed); });
+      }
+    });
+  }
+  Item item;
+  long long done = 0;
+  while (done < expected) {
+    if (queue.poll(item)) {
+      item();
+      ++done;
+    } else {
+      std::this_thread::yield();
+    }
+  }
+  for (auto& thread : threads) thread.join();
+  std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+  return elapsed.count();
+}
+
+int main() {
+  const int tasksPerProducer = 1000000;
+  for (long long maxPending : {0LL, 512LL}) {
+    for (int producers : {1, 2, 4, 8}) {
+      double mutexTime = run<MutexQueue, std::function<void()>>(producers, tasksPerProducer, maxPending);
+      double mpscTime = run<MPSCQueue<Task>, Task>(producers, tasksPerProducer, maxPending);
+      double total = (double)producers * tasksPerProducer;
+      printf("%s, %d producers: mutex deque %.1f Mtasks/s, MPSCQueue %.1f Mtasks/s\n",
+             maxPending == 0 ? "flood" : "bursts", producers, total / mutexTime / 1e6, total / mpscTime / 1e6);
+    }
+  }
+  return 0;
+}
@@ -83,8 +83,14 @@ void RDebugger::addOrModifyBreakpoint(DebugAddOrModifyBreakpointRequest const& r
 
   breakpoint->enabled = request.enabled();
   breakpoint->suspend = request.suspend();
-  breakpoint->condition = request.condition();
-  breakpoint->evaluateAndLog = request.evaluateandlog();
+  if (breakpoint->condition != request.condition() || breakpoint->evaluateAndLog != request.evaluateandlog()) {
+    breakpoint->condition = request.condition();
+    breakpoint->evaluateAndLog = request.evaluateandlog();
+    breakpoint->isCompiled = false;
+    breakpoint->compiledCondition = R_NilValue;
+    breakpoint->compiledEvaluateAndLog = R_NilValue;
+    breakpoint->evaluateAndLogError.clear();
+  }
   breakpoint->hitMessage = request.hitmessage();
   breakpoint->printStack = request.printstack();
   breakpoint->removeAfterHit = request.removeafterhit();
@@ -160,30 +166,52 @@ void RDebugger::setRunToPositionCommand(std::string const& fileId, int line) {
   runToPositionTarget = {sourceFileManager.getVirtualFileById(fileId), line};
 }
 
-static bool checkCondition(std::string const& condition, SEXP env) {
+static void compileBreakpoint(Breakpoint* breakpoint) {
+  if (breakpoint->isCompiled) return;
+  WithDebuggerEnabled with(false);
+  if (!breakpoint->condition.empty()) {
+    try {
+      breakpoint->compiledCondition = compileParsedExpression(parseCode(breakpoint->condition));
+    } catch (RError const&) {
+      breakpoint->compiledCondition = Rf_ScalarLogical(FALSE);
+    }
+  }
+  if (!breakpoint->evaluateAndLog.empty()) {
+    try {
+      breakpoint->compiledEvaluateAndLog = compileParsedExpression(parseCode(breakpoint->evaluateAndLog));
+    } catch (RError const& e) {
+      breakpoint->evaluateAndLogError = e.what();
+    }
+  }
+  breakpoint->isCompiled = true;
+}
+
+static bool checkCondition(Breakpoint* breakpoint, SEXP env) {
   SHIELD(env);
-  if (condition.empty()) {
+  if (breakpoint->condition.empty()) {
     return true;
   }
   try {
     WithDebuggerEnabled with(false);
-    ShieldSEXP expr = parseCode(condition);
-    ShieldSEXP result = RI->asLogical(RI->evalq(expr, env));
+    ShieldSEXP result = RI->asLogical(RI->evalq(breakpoint->compiledCondition, env));
     return asBool(result);
   } catch (RError const&) {
     return false;
   }
 }
 
-static void evaluateAndLog(std::string const& expression, SEXP env) {
+static void evaluateAndLog(Breakpoint* breakpoint, SEXP env) {
   SHIELD(env);
-  if (expression.empty()) {
+  if (breakpoint->evaluateAndLog.empty()) {
+    return;
+  }
+  if (!breakpoint->evaluateAndLogError.empty()) {
+    rpiService->writeToReplOutputHandler(breakpoint->evaluateAndLogError, STDERR);
     return;
   }
   try {
     WithDebuggerEnabled with(false);
-    ShieldSEXP expr = parseCode(expression);
-    rpiService->writeToReplOutputHandler(getPrintedValue(RI->evalq(expr, env)), STDERR);
+    rpiService->writeToReplOutputHandler(getPrintedValue(RI->evalq(breakpoint->compiledEvaluateAndLog, env)), STDERR);
   } catch (RError const& e) {
     rpiService->writeToReplOutputHandler(e.what(), STDERR);
   }
@@ -298,7 +326,8 @@ SEXP RDebugger::doStep(SEXP expr, SEXP env, SEXP srcref, bool alwaysStop, RConte
     if (!breakpointsMuted && breakpoint != nullptr && breakpoint->enabled && (breakpoint->master == nullptr || breakpoint->masterWasHit) &&
         Rf_getAttrib(srcref, RI->noBreakpointFlag) == R_NilValue) {
       CPP_BEGIN
-        if (checkCondition(breakpoint->condition, env)) {
+        compileBreakpoint(breakpoint);
+        if (checkCondition(breakpoint, env)) {
           if (!breakpoint->slaveLeaveEnabled) breakpoint->masterWasHit = false;
           for (Breakpoint *slave : breakpoint->slaves) {
             slave->masterWasHit = true;
@@ -309,7 +338,7 @@ SEXP RDebugger::doStep(SEXP expr, SEXP env, SEXP srcref, bool alwaysStop, RConte
           if (breakpoint->printStack) {
             printStack(buildStack(getContextDump(expr)));
           }
-          evaluateAndLog(breakpoint->evaluateAndLog, env);
+          evaluateAndLog(breakpoint, env);
           if (breakpoint->suspend) {
             suspend = true;
           }
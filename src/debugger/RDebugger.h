@@ -61,6 +61,12 @@ struct Breakpoint {
   bool printStack = false;
   bool removeAfterHit = false;
 
+  // Parsed and byte-compiled `condition` and `evaluateAndLog`, built on the first hit
+  bool isCompiled = false;
+  PrSEXP compiledCondition;
+  PrSEXP compiledEvaluateAndLog;
+  std::string evaluateAndLogError;
+
   Breakpoint* master = nullptr;
   bool slaveLeaveEnabled = false;
   std::vector<Breakpoint*> slaves;
@@ -29,6 +29,7 @@
 #include "PlotUtil.h"
 #include "RVersionHelper.h"
 #include "../RInternals/RInternals.h"
+#include "../Options.h"
 
 namespace graphics {
 namespace {
@@ -443,6 +444,12 @@ Plot MasterDevice::fetchPlot(int number) {
   }
 
   // Replay plot on the proxy device in order to extrapolate
+  if (commandLineOptions.singleReplayPlots) {
+    auto device = replayOnProxy(number, FIRST_PROXY_SIZE);
+    auto plot = PlotUtil::extrapolate(device->logicSizeInInches(), device->recordedActions(), totalComplexity);
+    DeviceManager::getInstance()->getProxy()->clearAllDevices();
+    return plot;
+  }
   auto firstDevice = replayOnProxy(number, FIRST_PROXY_SIZE);
   auto secondDevice = replayOnProxy(number, FIRST_PROXY_SIZE * 2);
   auto plot = PlotUtil::extrapolate(firstDevice->logicSizeInInches(), firstDevice->recordedActions(),
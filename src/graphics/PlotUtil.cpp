@@ -1,5 +1,7 @@
 #include "PlotUtil.h"
 
+#include <cmath>
+#include <cstdint>
 #include <limits>
 #include <iostream>
 #include <unordered_map>
@@ -39,6 +41,21 @@ const auto LINE_DISTANCE_THRESHOLD = 2.0 / 72.0;  // 2 px (in inches)
 const auto POLYLINE_LENGTH_THRESHOLD = 7;  // Note: prevent optimizing hexagons
 const auto MAX_CIRCLES_PER_CELL = 250;
 const auto CIRCLE_DISTANCE_THRESHOLD = 12.0 / 72.0;  // 12 px (in inches)
+const auto LOD_DISTANCE_THRESHOLD = 0.25 / 72.0;  // 1/4 px (in inches)
+const auto ANCHOR_DISTANCE_THRESHOLD = 1.0;  // inches
+const auto PROJECTION_SCALE = 2.0;
+
+double distanceToSegment(Point point, Point from, Point to) {
+  auto direction = to - from;
+  auto squaredLength = direction.x * direction.x + direction.y * direction.y;
+  if (isClose(squaredLength, 0.0, EPSILON * EPSILON)) {
+    return distance(point, from);
+  }
+  auto offset = point - from;
+  auto t = (offset.x * direction.x + offset.y * direction.y) / squaredLength;
+  t = std::min(std::max(t, 0.0), 1.0);
+  return distance(point, from + t * direction);
+}
 
 struct Intersection {
   bool isExistent;
@@ -178,6 +195,197 @@ std::pair<int, int> getGridIndices(Point point, const Rectangle& area, int gridS
   return std::make_pair(x, y);
 }
 
+/**
+ * Synthesizes the actions which would have been recorded on a device of another size
+ * so that a plot can be extrapolated from a single replay.
+ * The layout is assumed to obey the following model:
+ *  1) coordinates which are closer than ANCHOR_DISTANCE_THRESHOLD to an edge of some clipping area
+ *     (i.e. margins, axis ticks and labels) keep a fixed distance (in inches) to this edge;
+ *  2) other coordinates scale proportionally to the smallest clipping area containing them;
+ *  3) points inside of nested clipping areas (i.e. data points) always scale proportionally to this area;
+ *  4) radii and font sizes don't depend on a device size.
+ * This is true for the most of base and GGPlot charts, however, unlike the second replay,
+ * it's just a heuristic
+ */
+class ActionProjector {
+private:
+  std::vector<Rectangle> clippingAreas;
+  std::vector<Rectangle> projectedClippingAreas;
+  int currentClippingAreaIndex = 0;
+
+  static double getLower(const Rectangle& area, bool isVertical) {
+    return isVertical ? area.from.y : area.from.x;
+  }
+
+  static double getUpper(const Rectangle& area, bool isVertical) {
+    return isVertical ? area.to.y : area.to.x;
+  }
+
+  double projectProportionally(double coordinate, bool isVertical, int areaIndex) const {
+    auto lower = getLower(clippingAreas[areaIndex], isVertical);
+    auto upper = getUpper(clippingAreas[areaIndex], isVertical);
+    auto projectedLower = getLower(projectedClippingAreas[areaIndex], isVertical);
+    auto projectedUpper = getUpper(projectedClippingAreas[areaIndex], isVertical);
+    if (isClose(lower, upper)) {
+      return projectedLower + (coordinate - lower);
+    }
+    return projectedLower + (coordinate - lower) / (upper - lower) * (projectedUpper - projectedLower);
+  }
+
+  double projectAnchored(double coordinate, bool isVertical) const {
+    auto minDistance = ANCHOR_DISTANCE_THRESHOLD;
+    auto anchorIndex = -1;
+    auto isUpperAnchor = false;
+    auto areaCount = int(clippingAreas.size());
+    for (auto i = 0; i < areaCount; i++) {
+      auto lowerDistance = std::abs(coordinate - getLower(clippingAreas[i], isVertical));
+      auto upperDistance = std::abs(coordinate - getUpper(clippingAreas[i], isVertical));
+      if (lowerDistance < minDistance) {
+        minDistance = lowerDistance;
+        isUpperAnchor = false;
+        anchorIndex = i;
+      }
+      if (upperDistance < minDistance) {
+        minDistance = upperDistance;
+        isUpperAnchor = true;
+        anchorIndex = i;
+      }
+    }
+    if (anchorIndex >= 0) {
+      const auto& area = clippingAreas[anchorIndex];
+      const auto& projectedArea = projectedClippingAreas[anchorIndex];
+      if (isUpperAnchor) {
+        return getUpper(projectedArea, isVertical) + (coordinate - getUpper(area, isVertical));
+      } else {
+        return getLower(projectedArea, isVertical) + (coordinate - getLower(area, isVertical));
+      }
+    }
+    return projectProportionally(coordinate, isVertical, findSmallestContainingArea(coordinate, isVertical));
+  }
+
+  int findSmallestContainingArea(double coordinate, bool isVertical) const {
+    auto minSpan = std::numeric_limits<double>::max();
+    auto areaIndex = 0;
+    auto areaCount = int(clippingAreas.size());
+    for (auto i = 1; i < areaCount; i++) {
+      auto lower = getLower(clippingAreas[i], isVertical);
+      auto upper = getUpper(clippingAreas[i], isVertical);
+      if (coordinate > lower - EPSILON && coordinate < upper + EPSILON && upper - lower < minSpan) {
+        minSpan = upper - lower;
+        areaIndex = i;
+      }
+    }
+    return areaIndex;
+  }
+
+  Point project(Point point) const {
+    if (currentClippingAreaIndex != 0) {
+      auto x = projectProportionally(point.x, false, currentClippingAreaIndex);
+      auto y = projectProportionally(point.y, true, currentClippingAreaIndex);
+      return Point{x, y};
+    } else {
+      return Point{projectAnchored(point.x, false), projectAnchored(point.y, true)};
+    }
+  }
+
+  Rectangle project(const Rectangle& rectangle) const {
+    return Rectangle{project(rectangle.from), project(rectangle.to)};
+  }
+
+  std::vector<Point> project(const std::vector<Point>& points) const {
+    auto projected = std::vector<Point>();
+    projected.reserve(points.size());
+    for (auto point : points) {
+      projected.push_back(project(point));
+    }
+    return projected;
+  }
+
+  int getOrRegisterClippingAreaIndex(const Rectangle& area) {
+    auto areaCount = int(clippingAreas.size());
+    for (auto i = 0; i < areaCount; i++) {
+      if (isClose(area, clippingAreas[i])) {
+        return i;
+      }
+    }
+    // Note: edges of a new clipping area are projected against the previously registered ones
+    auto projectedFrom = Point{projectAnchored(area.from.x, false), projectAnchored(area.from.y, true)};
+    auto projectedTo = Point{projectAnchored(area.to.x, false), projectAnchored(area.to.y, true)};
+    clippingAreas.push_back(area);
+    projectedClippingAreas.push_back(Rectangle{projectedFrom, projectedTo});
+    return areaCount;
+  }
+
+  Ptr<Action> project(const Ptr<Action>& action) {
+    switch (action->getKind()) {
+      case ActionKind::CIRCLE: {
+        auto circle = dynamic_cast<const CircleAction*>(action.get());
+        return makePtr<CircleAction>(project(circle->getCenter()), circle->getRadius(), circle->getStroke(),
+                                     circle->getColor(), circle->getFill());
+      }
+      case ActionKind::CLIP: {
+        auto clip = dynamic_cast<const ClipAction*>(action.get());
+        currentClippingAreaIndex = getOrRegisterClippingAreaIndex(clip->getArea());
+        return makePtr<ClipAction>(projectedClippingAreas[currentClippingAreaIndex]);
+      }
+      case ActionKind::LINE: {
+        auto line = dynamic_cast<const LineAction*>(action.get());
+        return makePtr<LineAction>(project(line->getFrom()), project(line->getTo()), line->getStroke(), line->getColor());
+      }
+      case ActionKind::NEW_PAGE:
+        return action;  // Note: doesn't contain any coordinates
+      case ActionKind::PATH: {
+        auto path = dynamic_cast<const PathAction*>(action.get());
+        auto subPaths = std::vector<std::vector<Point>>();
+        subPaths.reserve(path->getSubPaths().size());
+        for (const auto& subPath : path->getSubPaths()) {
+          subPaths.push_back(project(subPath));
+        }
+        return makePtr<PathAction>(std::move(subPaths), path->getWinding(), path->getStroke(), path->getColor(), path->getFill());
+      }
+      case ActionKind::POLYGON: {
+        auto polygon = dynamic_cast<const PolygonAction*>(action.get());
+        return makePtr<PolygonAction>(project(polygon->getPoints()), polygon->getStroke(), polygon->getColor(), polygon->getFill());
+      }
+      case ActionKind::POLYLINE: {
+        auto polyline = dynamic_cast<const PolylineAction*>(action.get());
+        return makePtr<PolylineAction>(project(polyline->getPoints()), polyline->getStroke(), polyline->getColor());
+      }
+      case ActionKind::RASTER: {
+        auto raster = dynamic_cast<const RasterAction*>(action.get());
+        return makePtr<RasterAction>(raster->getImage(), project(raster->getRectangle()), raster->getAngle(), raster->getInterpolate());
+      }
+      case ActionKind::RECTANGLE: {
+        auto rectangle = dynamic_cast<const RectangleAction*>(action.get());
+        return makePtr<RectangleAction>(project(rectangle->getRectangle()), rectangle->getStroke(),
+                                        rectangle->getColor(), rectangle->getFill());
+      }
+      case ActionKind::TEXT: {
+        auto text = dynamic_cast<const TextAction*>(action.get());
+        return makePtr<TextAction>(text->getText(), project(text->getPosition()), text->getAngle(),
+                                   text->getAnchor(), text->getFont(), text->getColor());
+      }
+      default:
+        throw ParsingError(PlotError::UNSUPPORTED_ACTION);
+    }
+  }
+
+public:
+  ActionProjector(Size size, Size projectedSize) {
+    clippingAreas.push_back(Rectangle::make(Point{0.0, 0.0}, size.toPoint()));
+    projectedClippingAreas.push_back(Rectangle::make(Point{0.0, 0.0}, projectedSize.toPoint()));
+  }
+
+  std::vector<Ptr<Action>> project(const std::vector<Ptr<Action>>& actions) {
+    auto projected = std::vector<Ptr<Action>>();
+    projected.reserve(actions.size());
+    for (const auto& action : actions) {
+      projected.push_back(project(action));
+    }
+    return projected;
+  }
+};
+
 class DifferentialParser {
 private:
   enum class State {
@@ -264,6 +472,9 @@ private:
       secondCircles.push_back(pair.second);
     }
     currentActionIndex--;
+    if (firstCircles.size() > 1U) {
+      removeCoveredCircles(firstCircles, secondCircles);
+    }
     if (firstCircles.size() == 1U) {
       return extrapolateCircle(firstCircles[0], secondCircles[0], /* isMasked */ false);
     } else {
@@ -276,6 +487,72 @@ private:
     }
   }
 
+  /**
+   * Remove circles which are (up to LOD_DISTANCE_THRESHOLD) covered by the identical circles painted later.
+   * This is only done for opaque circles since otherwise the result of painting would depend
+   * on the number of overlapping circles
+   */
+  static void removeCoveredCircles(std::vector<const CircleAction*>& firstCircles, std::vector<const CircleAction*>& secondCircles) {
+    auto circleCount = int(firstCircles.size());
+    auto isKept = std::vector<bool>(circleCount, true);
+    auto cells = std::unordered_map<int64_t, std::vector<int>>();
+    auto getCellKey = [](int64_t x, int64_t y) {
+      return (x << 32) ^ (y & 0xffffffffLL);
+    };
+    auto keptCount = 0;
+    for (auto i = circleCount - 1; i >= 0; i--) {
+      auto circle = firstCircles[i];
+      auto center = circle->getCenter();
+      auto cellX = int64_t(std::floor(center.x / LOD_DISTANCE_THRESHOLD));
+      auto cellY = int64_t(std::floor(center.y / LOD_DISTANCE_THRESHOLD));
+      if (isSolid(circle)) {
+        for (auto dx = -1; dx <= 1 && isKept[i]; dx++) {
+          for (auto dy = -1; dy <= 1 && isKept[i]; dy++) {
+            auto it = cells.find(getCellKey(cellX + dx, cellY + dy));
+            if (it == cells.end()) {
+              continue;
+            }
+            for (auto j : it->second) {
+              if (isSameLook(circle, firstCircles[j]) && distance(center, firstCircles[j]->getCenter()) < LOD_DISTANCE_THRESHOLD) {
+                isKept[i] = false;
+                break;
+              }
+            }
+          }
+        }
+      }
+      if (isKept[i]) {
+        cells[getCellKey(cellX, cellY)].push_back(i);
+        keptCount++;
+      }
+    }
+    if (keptCount == circleCount) {
+      return;
+    }
+    auto index = 0;
+    for (auto i = 0; i < circleCount; i++) {
+      if (isKept[i]) {
+        firstCircles[index] = firstCircles[i];
+        secondCircles[index] = secondCircles[i];
+        index++;
+      }
+    }
+    firstCircles.resize(keptCount);
+    secondCircles.resize(keptCount);
+  }
+
+  static bool isSolid(const CircleAction* circle) {
+    auto isSolidColor = [](Color color) {
+      return color.isOpaque() || color.isTransparent();
+    };
+    return isSolidColor(circle->getColor()) && isSolidColor(circle->getFill());
+  }
+
+  static bool isSameLook(const CircleAction* first, const CircleAction* second) {
+    return first->getColor().value == second->getColor().value && first->getFill().value == second->getFill().value
+           && isClose(first->getRadius(), second->getRadius()) && isClose(first->getStroke(), second->getStroke());
+  }
+
   std::vector<bool> buildPreviewMask(const std::vector<const CircleAction*>& circles) {
     auto circleCount = int(circles.size());
     auto cellCount = circleCount / MAX_CIRCLES_PER_CELL;
@@ -426,7 +703,7 @@ private:
       auto to = extrapolate(firstPolyline->getPoints()[1], secondPolyline->getPoints()[1]);
       return makePtr<LineFigure>(from, to, strokeIndex, colorIndex);
     } else {
-      auto polyline = extrapolate(firstPolyline->getPoints(), secondPolyline->getPoints());
+      auto polyline = extrapolateSimplified(firstPolyline->getPoints(), secondPolyline->getPoints());
       return makePtr<PolylineFigure>(std::move(polyline), strokeIndex, colorIndex);
     }
   }
@@ -521,6 +798,68 @@ private:
     return Polyline{std::move(points), std::move(preview.first), preview.second};
   }
 
+  /**
+   * Same as above but the points which deviate from the polyline
+   * by less than LOD_DISTANCE_THRESHOLD are dropped completely
+   */
+  Polyline extrapolateSimplified(const std::vector<Point>& firstPoints, const std::vector<Point>& secondPoints) {
+    if (firstPoints.size() != secondPoints.size()) {
+      throw ParsingError(PlotError::MISMATCHING_ACTIONS);
+    }
+    auto pointCount = int(firstPoints.size());
+    if (pointCount <= POLYLINE_LENGTH_THRESHOLD) {
+      return extrapolate(firstPoints, secondPoints);
+    }
+    auto isRemovable = buildSimplificationMask(firstPoints, LOD_DISTANCE_THRESHOLD);
+    auto keptFirstPoints = std::vector<Point>();
+    auto keptSecondPoints = std::vector<Point>();
+    for (auto i = 0; i < pointCount; i++) {
+      if (!isRemovable[i]) {
+        keptFirstPoints.push_back(firstPoints[i]);
+        keptSecondPoints.push_back(secondPoints[i]);
+      }
+    }
+    return extrapolate(keptFirstPoints, keptSecondPoints);
+  }
+
+  /**
+   * An iterative implementation of the Ramer-Douglas-Peucker algorithm.
+   * Unlike the recursive one below, it doesn't overflow the stack on the polylines with millions of points
+   */
+  static std::vector<bool> buildSimplificationMask(const std::vector<Point>& points, double threshold) {
+    auto mask = std::vector<bool>(points.size(), false);  // `true` means that a point [i] can be removed
+    auto ranges = std::vector<std::pair<int, int>>{{0, int(points.size())}};  // [startIndex, endIndex)
+    while (!ranges.empty()) {
+      auto range = ranges.back();
+      ranges.pop_back();
+      auto startIndex = range.first;
+      auto endIndex = range.second;
+      if (endIndex - startIndex <= 2) {
+        continue;
+      }
+      // Note: unlike the preview mask, distances are measured to the segment rather than to the line
+      // since otherwise the points which go back and forth along the same line would be lost
+      auto maxDistance = 0.0;
+      auto maxDistanceIndex = -1;
+      for (auto index = startIndex + 1; index < endIndex - 1; index++) {
+        auto distance = distanceToSegment(points[index], points[startIndex], points[endIndex - 1]);
+        if (distance > maxDistance) {
+          maxDistanceIndex = index;
+          maxDistance = distance;
+        }
+      }
+      if (maxDistance < threshold) {
+        for (auto index = startIndex + 1; index < endIndex - 1; index++) {
+          mask[index] = true;
+        }
+      } else {
+        ranges.emplace_back(startIndex, maxDistanceIndex + 1);
+        ranges.emplace_back(maxDistanceIndex, endIndex);
+      }
+    }
+    return mask;
+  }
+
   static std::pair<std::vector<bool>, int> buildPreviewMask(const std::vector<Point>& points) {
     auto mask = std::vector<bool>(points.size(), false);  // `true` means that a point [i] might be skipped in a preview
     auto pointCount = int(points.size());
@@ -923,4 +1262,18 @@ Plot PlotUtil::extrapolate(Size firstSize, const std::vector<Ptr<Action>>& first
   }
 }
 
+Plot PlotUtil::extrapolate(Size size, const std::vector<Ptr<Action>>& actions, int totalComplexity) {
+  try {
+    auto projectedSize = size * PROJECTION_SCALE;
+    auto projectedActions = ActionProjector(size, projectedSize).project(actions);
+    auto parser = DifferentialParser(size, actions, projectedSize, projectedActions, totalComplexity);
+    parser.parse();
+    return parser.buildPlot();
+  } catch (const ParsingError& e) {
+    return createPlotWithError(e.getError());
+  } catch (const std::exception& e) {
+    return createPlotWithError(PlotError::UNKNOWN);
+  }
+}
+
 }  // graphics
@@ -18,6 +18,12 @@ public:
   static Plot extrapolate(/* inches */ Size firstSize, const std::vector<Ptr<Action>>& firstActions,
                           /* inches */ Size secondSize, const std::vector<Ptr<Action>>& secondActions,
                           int totalComplexity);
+
+  /**
+   * Same as above but the second replay is synthesized from the first one.
+   * See `ActionProjector` for the layout assumptions this relies on
+   */
+  static Plot extrapolate(/* inches */ Size size, const std::vector<Ptr<Action>>& actions, int totalComplexity);
 };
 
 }  // graphics
@@ -0,0 +1,86 @@
+//  Rkernel is an execution kernel for R interpreter
+//  Copyright (C) 2019 JetBrains s.r.o.
+//
+//  This program is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+// Compares formatRealCells with `format(x, trim = TRUE)` in an embedded R
+// for the given `digits` and `scipen` options.
+
+#include "../RStuff/FormatReal.h"
+#include "../RStuff/MySEXP.h"
+#include <cstdio>
+#include <string>
+#include <R_ext/Parse.h>
+
+#ifdef RWRAPPER_DEBUG
+int unprotectCheckDisabled = 0;
+#endif
+
+static SEXP evalText(std::string const& code) {
+  ShieldSEXP text = Rf_mkString(code.c_str());
+  ParseStatus status;
+  ShieldSEXP exprs = R_ParseVector(text, -1, &status, R_NilValue);
+  if (status != PARSE_OK) return R_NilValue;
+  SEXP result = R_NilValue;
+  for (int i = 0; i < Rf_length(exprs); ++i) {
+    result = Rf_eval(VECTOR_ELT(exprs, i), R_GlobalEnv);
+  }
+  return result;
+}
+
+static bool check(const char* expr, int digits = 7, int scipen = 0) {
+  evalText("options(digits = " + std::to_string(digits) + ", scipen = " + std::to_string(scipen) + ")");
+  ShieldSEXP value = evalText(expr);
+  Rf_defineVar(Rf_install("x"), value, R_GlobalEnv);
+  ShieldSEXP expected = evalText("format(x, trim = TRUE)");
+  R_xlen_t length = Rf_xlength(value);
+  std::vector<std::string> actual = formatRealCells(value, length, digits, scipen);
+  bool ok = true;
+  for (R_xlen_t i = 0; i < length; ++i) {
+    const char* expectedCell = CHAR(STRING_ELT(expected, i));
+    if (actual[i] == expectedCell) continue;
+    fprintf(stderr, "%s (digits = %d, scipen = %d)[%lld]: expected %s, got %s\n",
+            expr, digits, scipen, (long long)i + 1, expectedCell, actual[i].c_str());
+    ok = false;
+  }
+  return ok;
+}
+
+int main() {
+  const char* argv[] = {"R", "--vanilla", "--silent", "--slave"};
+  Rf_initEmbeddedR(4, (char**)argv);
+
+  bool ok = true;
+  ok &= check("1e15");
+  ok &= check("1e-5");
+  ok &= check("0.1 + 0.2");
+  ok &= check("0.1 + 0.2", 22);
+  ok &= check("c(1, 1.5, -2.25)");
+  ok &= check("c(1e5, 1)");
+  ok &= check("c(1e5, 1)", 7, 1);
+  ok &= check("0.3", 7, -5);
+  ok &= check("c(123456, 0.001)", 7, -2);
+  ok &= check("9996", 3);
+  ok &= check("c(0.99999, 99.5)", 2);
+  ok &= check("1e-30", 7, 100);
+  ok &= check("c(1e300, -1e-300)");
+  ok &= check("123456789.123");
+  ok &= check("123456789.123", 15);
+  ok &= check("pi", 1);
+  ok &= check("c(-0, 0, 2)");
+  ok &= check("c(NA, NaN, Inf, -Inf, 1.5)");
+
+  Rf_endEmbeddedR(0);
+  return ok ? 0 : 1;
+}
@@ -0,0 +1,74 @@
+//  Rkernel is an execution kernel for R interpreter
+//  Copyright (C) 2019 JetBrains s.r.o.
+//
+//  This program is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+// Compares ObjectSizeEstimator with `utils::object.size` in an embedded R.
+// The values are chosen so that no object is reachable twice, where the estimator counts it only once.
+// Many strings are kept alive first, so that the hash chains of the global string cache are not empty.
+
+#include "../RStuff/ObjectSizeEstimator.h"
+#include <cstdio>
+#include <R_ext/Parse.h>
+
+#ifdef RWRAPPER_DEBUG
+int unprotectCheckDisabled = 0;
+#endif
+
+static SEXP evalText(const char* code) {
+  ShieldSEXP text = Rf_mkString(code);
+  ParseStatus status;
+  ShieldSEXP exprs = R_ParseVector(text, -1, &status, R_NilValue);
+  if (status != PARSE_OK) return R_NilValue;
+  SEXP result = R_NilValue;
+  for (int i = 0; i < Rf_length(exprs); ++i) {
+    result = Rf_eval(VECTOR_ELT(exprs, i), R_GlobalEnv);
+  }
+  return result;
+}
+
+static bool check(const char* expr) {
+  ShieldSEXP value = evalText(expr);
+  Rf_defineVar(Rf_install("x"), value, R_GlobalEnv);
+  long long expected = (long long)Rf_asReal(evalText("as.numeric(utils::object.size(x))"));
+  ObjectSizeEstimator estimator(value);
+  while (!estimator.advance(std::chrono::steady_clock::now() + std::chrono::milliseconds(20))) {}
+  long long actual = estimator.getSize();
+  if (actual == expected) return true;
+  fprintf(stderr, "%s: expected %lld, got %lld\n", expr, expected, actual);
+  return false;
+}
+
+int main() {
+  const char* argv[] = {"R", "--vanilla", "--silent", "--slave"};
+  Rf_initEmbeddedR(4, (char**)argv);
+  evalText("keep <- as.character(seq_len(100000))");
+
+  bool ok = true;
+  ok &= check("c('a', 'b')");
+  ok &= check("c('a', NA)");
+  ok &= check("c('a', 'a', 'b')");
+  ok &= check("paste(rep('long string', 10), collapse = ' ')");
+  ok &= check("1:10");
+  ok &= check("c(1.5, 2.5)");
+  ok &= check("c(1i, 2i)");
+  ok &= check("as.raw(1:100)");
+  ok &= check("list(1, 'a', TRUE)");
+  ok &= check("c(p = 1, q = 2)");
+  ok &= check("quote(f(y, 1))");
+  ok &= check("data.frame(p = 1:3, q = c('a', 'b', 'c'), stringsAsFactors = FALSE)");
+
+  Rf_endEmbeddedR(0);
+  return ok ? 0 : 1;
+}
@@ -21,6 +21,7 @@
 #include <condition_variable>
 #include <mutex>
 #include <deque>
+#include <utility>
 
 template <typename T>
 class BlockingQueue {
@@ -37,6 +38,45 @@ public:
     condVar.notify_one();
   }
 
+  void push(T&& value) {
+    std::unique_lock<std::mutex> lock(mutex);
+    if (maxSize != 0) {
+      condVar.wait(lock, [&] { return queue.size() < maxSize; });
+    }
+    queue.push_front(std::move(value));
+    condVar.notify_one();
+  }
+
+  // Lets `merge` fold the new value into the most recently pushed element if it's still in the queue,
+  // otherwise pushes the element built by `make`
+  template <typename Merge, typename Make>
+  void pushOrMerge(Merge const& merge, Make const& make) {
+    std::unique_lock<std::mutex> lock(mutex);
+    while (true) {
+      if (!queue.empty() && merge(queue.front())) return;
+      if (maxSize == 0 || queue.size() < maxSize) break;
+      condVar.wait(lock);
+    }
+    queue.push_front(make());
+    condVar.notify_one();
+  }
+
+  // Same as pushOrMerge, but gives up and returns false if the queue is still full at `deadline`
+  template <typename TimePoint, typename Merge, typename Make>
+  bool pushOrMergeWithDeadline(TimePoint const& deadline, Merge const& merge, Make const& make) {
+    std::unique_lock<std::mutex> lock(mutex);
+    bool timedOut = false;
+    while (true) {
+      if (!queue.empty() && merge(queue.front())) return true;
+      if (maxSize == 0 || queue.size() < maxSize) break;
+      if (timedOut) return false;
+      timedOut = condVar.wait_until(lock, deadline) == std::cv_status::timeout;
+    }
+    queue.push_front(make());
+    condVar.notify_one();
+    return true;
+  }
+
   T pop() {
     std::unique_lock<std::mutex> lock(mutex);
     condVar.wait(lock, [&] { return !queue.empty(); });
@@ -66,6 +106,11 @@ public:
     return true;
   }
 
+  bool isEmpty() {
+    std::unique_lock<std::mutex> lock(mutex);
+    return queue.empty();
+  }
+
   void setMaxSize(size_t newSize) {
     std::unique_lock<std::mutex> lock(mutex);
     maxSize = newSize;
@@ -0,0 +1,109 @@
+//  Rkernel is an execution kernel for R interpreter
+//  Copyright (C) 2019 JetBrains s.r.o.
+//
+//  This program is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+
+#ifndef RWRAPPER_MPSC_QUEUE_H
+#define RWRAPPER_MPSC_QUEUE_H
+
+#include <atomic>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+
+// Bounded lock-free multi-producer single-consumer queue (based on D. Vyukov's bounded MPMC queue).
+// push() may be called from any thread, poll() must only be called from the consumer thread.
+// If the ring is full, push() appends to a mutex-guarded overflow list instead, which is drained after the ring.
+template <typename T>
+class MPSCQueue {
+public:
+  // capacity must be a power of two
+  explicit MPSCQueue(size_t capacity = 1024) : cells(new Cell[capacity]), mask(capacity - 1) {
+    for (size_t i = 0; i < capacity; ++i) {
+      cells[i].sequence.store(i, std::memory_order_relaxed);
+    }
+  }
+
+  MPSCQueue(MPSCQueue const&) = delete;
+  MPSCQueue& operator = (MPSCQueue const&) = delete;
+
+  void push(T value) {
+    // Once something has overflowed, later tasks go after it to keep the order
+    if (!hasOverflow.load(std::memory_order_acquire) && tryPush(value)) return;
+    std::lock_guard<std::mutex> lock(overflowMutex);
+    overflow.push_back(std::move(value));
+    hasOverflow.store(true, std::memory_order_release);
+  }
+
+  bool tryPush(T &value) {
+    size_t pos = tail.load(std::memory_order_relaxed);
+    Cell* cell;
+    while (true) {
+      cell = &cells[pos & mask];
+      size_t sequence = cell->sequence.load(std::memory_order_acquire);
+      intptr_t diff = (intptr_t)sequence - (intptr_t)pos;
+      if (diff == 0) {
+        if (tail.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) break;
+      } else if (diff < 0) {
+        return false;
+      } else {
+        pos = tail.load(std::memory_order_relaxed);
+      }
+    }
+    cell->value = std::move(value);
+    cell->sequence.store(pos + 1, std::memory_order_release);
+    return true;
+  }
+
+  bool poll(T &value) {
+    if (pollRing(value)) return true;
+    if (!hasOverflow.load(std::memory_order_acquire)) return false;
+    std::lock_guard<std::mutex> lock(overflowMutex);
+    // The ring may have been refilled by producers which checked the flag before it was set
+    if (pollRing(value)) return true;
+    if (overflow.empty()) return false;
+    value = std::move(overflow.front());
+    overflow.pop_front();
+    if (overflow.empty()) hasOverflow.store(false, std::memory_order_release);
+    return true;
+  }
+
+private:
+  bool pollRing(T &value) {
+    Cell* cell = &cells[head & mask];
+    size_t sequence = cell->sequence.load(std::memory_order_acquire);
+    if ((intptr_t)sequence - (intptr_t)(head + 1) < 0) return false;
+    value = std::move(cell->value);
+    cell->sequence.store(head + mask + 1, std::memory_order_release);
+    ++head;
+    return true;
+  }
+
+  struct Cell {
+    std::atomic<size_t> sequence;
+    T value;
+  };
+
+  std::unique_ptr<Cell[]> cells;
+  const size_t mask;
+  alignas(64) std::atomic<size_t> tail{0};
+  alignas(64) size_t head = 0;
+  std::atomic<bool> hasOverflow{false};
+  std::mutex overflowMutex;
+  std::deque<T> overflow;
+};
+
+#endif //RWRAPPER_MPSC_QUEUE_H
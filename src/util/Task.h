@@ -0,0 +1,124 @@
+//  Rkernel is an execution kernel for R interpreter
+//  Copyright (C) 2019 JetBrains s.r.o.
+//
+//  This program is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+
+#ifndef RWRAPPER_TASK_H
+#define RWRAPPER_TASK_H
+
+#include <cstddef>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+// Move-only replacement for std::function<void()>.
+// Small callables are stored inline, so queueing them doesn't allocate.
+class Task {
+public:
+  Task() = default;
+
+  template <typename F, typename = std::enable_if_t<!std::is_same<std::decay_t<F>, Task>::value>>
+  Task(F&& f) {
+    using Func = std::decay_t<F>;
+    init<Func>(std::forward<F>(f), std::integral_constant<bool, isInline<Func>()>());
+  }
+
+  Task(Task&& b) noexcept : ops(b.ops) {
+    if (ops != nullptr) {
+      ops->move(&b.storage, &storage);
+      b.ops = nullptr;
+    }
+  }
+
+  Task& operator = (Task&& b) noexcept {
+    if (this != &b) {
+      reset();
+      ops = b.ops;
+      if (ops != nullptr) {
+        ops->move(&b.storage, &storage);
+        b.ops = nullptr;
+      }
+    }
+    return *this;
+  }
+
+  Task(Task const&) = delete;
+  Task& operator = (Task const&) = delete;
+
+  ~Task() {
+    reset();
+  }
+
+  void operator () () {
+    ops->invoke(&storage);
+  }
+
+  explicit operator bool() const {
+    return ops != nullptr;
+  }
+
+  void reset() {
+    if (ops != nullptr) {
+      ops->destroy(&storage);
+      ops = nullptr;
+    }
+  }
+
+private:
+  static const size_t INLINE_SIZE = 48;
+  using Storage = std::aligned_storage<INLINE_SIZE, alignof(std::max_align_t)>::type;
+
+  struct Ops {
+    void (*invoke)(void*);
+    void (*move)(void* from, void* to);
+    void (*destroy)(void*);
+  };
+
+  template <typename Func>
+  static constexpr bool isInline() {
+    return sizeof(Func) <= INLINE_SIZE && alignof(Func) <= alignof(Storage) &&
+           std::is_nothrow_move_constructible<Func>::value;
+  }
+
+  template <typename Func, typename F>
+  void init(F&& f, std::true_type) {
+    static const Ops inlineOps = {
+        [] (void* s) { (*(Func*)s)(); },
+        [] (void* from, void* to) {
+          new (to) Func(std::move(*(Func*)from));
+          ((Func*)from)->~Func();
+        },
+        [] (void* s) { ((Func*)s)->~Func(); }
+    };
+    new (&storage) Func(std::forward<F>(f));
+    ops = &inlineOps;
+  }
+
+  template <typename Func, typename F>
+  void init(F&& f, std::false_type) {
+    static const Ops heapOps = {
+        [] (void* s) { (**(Func**)s)(); },
+        [] (void* from, void* to) { *(Func**)to = *(Func**)from; },
+        [] (void* s) { delete *(Func**)s; }
+    };
+    *(Func**)&storage = new Func(std::forward<F>(f));
+    ops = &heapOps;
+  }
+
+  Storage storage;
+  const Ops* ops = nullptr;
+};
+
+#endif //RWRAPPER_TASK_H